@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+namespace fib {
+
+struct background_write_status
+{
+	std::uint64_t submitted = 0;
+	std::uint64_t completed = 0;
+	std::uint64_t failed = 0;
+	std::uint64_t superseded = 0;  // replaced in the queue by a newer job before they started
+	std::size_t queued = 0;
+	bool busy = false;
+	std::string last_name{};       // last finished job
+	bool last_ok = true;
+	double last_seconds = 0.;
+};
+
+/*
+ *  one thread that runs file writes off the caller's thread. The queue is
+ *  bounded: submit() never waits, once max_depth jobs are queued the newest
+ *  queued job is replaced, the saves it stood for are superseded anyway.
+ *  Queued jobs are still written when the writer is destroyed.
+ */
+class background_writer
+{
+private:
+	struct job
+	{
+		std::string name;
+		std::function<bool()> write;
+	};
+
+	mutable std::mutex mutex_{};
+	std::condition_variable wake_{};
+	std::deque<job> queue_{};
+	std::size_t max_depth_;
+	bool stopping_ = false;
+	background_write_status status_{};
+	std::thread thread_{};
+
+	void run()
+	{
+		using clock = std::chrono::steady_clock;
+
+		while (true)
+		{
+			job next{};
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				wake_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+				if (queue_.empty())
+					return;
+
+				next = std::move(queue_.front());
+				queue_.pop_front();
+				status_.queued = queue_.size();
+				status_.busy = true;
+			}
+
+			auto const start = clock::now();
+			auto const ok = next.write();
+			auto const seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+			std::lock_guard<std::mutex> lock(mutex_);
+			++(ok ? status_.completed : status_.failed);
+			status_.busy = false;
+			status_.last_name = std::move(next.name);
+			status_.last_ok = ok;
+			status_.last_seconds = seconds;
+		}
+	}
+
+public:
+	explicit background_writer(std::size_t max_depth = 2) : max_depth_(max_depth < 1 ? 1 : max_depth)
+	{
+		thread_ = std::thread{ [this]() { run(); } };
+	}
+
+	background_writer(background_writer const&) = delete;
+	background_writer& operator=(background_writer const&) = delete;
+
+	~background_writer()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = true;
+		}
+		wake_.notify_one();
+		thread_.join();
+	}
+
+	// write returns false on failure, it runs on the writer thread and owns everything it captured
+	void submit(std::string name, std::function<bool()> write)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			++status_.submitted;
+			if (queue_.size() >= max_depth_)
+			{
+				queue_.back() = job{ std::move(name), std::move(write) };
+				++status_.superseded;
+			}
+			else
+			{
+				queue_.push_back(job{ std::move(name), std::move(write) });
+			}
+			status_.queued = queue_.size();
+		}
+		wake_.notify_one();
+	}
+
+	background_write_status status() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return status_;
+	}
+};
+
+}
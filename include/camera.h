@@ -0,0 +1,114 @@
+#pragma once
+
+#include "matrix.h"
+
+#include <array>
+
+namespace fib {
+
+/*
+ *  2d view onto cached world space geometry. The viewport upper left corner
+ *  shows world point (left, top), x grows to the right and y grows upwards in
+ *  world space, scales are in pixels per world unit.
+ *
+ *  screen.x = viewport.x + (world.x - left) * scale_x
+ *  screen.y = viewport.y + (top - world.y) * scale_y
+ */
+class camera2d
+{
+private:
+	double left_ = 0., top_ = 0.;
+	double scale_x_ = 1., scale_y_ = 1.;
+	double viewport_x_ = 0., viewport_y_ = 0.;
+	double viewport_width_ = 1., viewport_height_ = 1.;
+
+public:
+	camera2d() = default;
+
+	// getters
+	double left() const { return left_; }
+	double top() const { return top_; }
+	double right() const { return left_ + viewport_width_ / scale_x_; }
+	double bottom() const { return top_ - viewport_height_ / scale_y_; }
+	double scale_x() const { return scale_x_; }
+	double scale_y() const { return scale_y_; }
+
+	// setters
+	void viewport(double x, double y, double width, double height)
+	{
+		viewport_x_ = x;
+		viewport_y_ = y;
+		viewport_width_ = width;
+		viewport_height_ = height;
+	}
+
+	// stretch the world box over the whole viewport
+	void fit(double min_x, double min_y, double max_x, double max_y)
+	{
+		auto const world_width = max_x - min_x;
+		auto const world_height = max_y - min_y;
+
+		left_ = min_x;
+		top_ = max_y;
+		scale_x_ = world_width > 0. ? viewport_width_ / world_width : 1.;
+		scale_y_ = world_height > 0. ? viewport_height_ / world_height : 1.;
+	}
+
+	// operations
+	void pan(double dx, double dy)
+	{
+		left_ -= dx / scale_x_;
+		top_ += dy / scale_y_;
+	}
+
+	// keeps the world point under (x, y) in place
+	void zoom_at(double x, double y, double factor)
+	{
+		auto const wx = left_ + (x - viewport_x_) / scale_x_;
+		auto const wy = top_ - (y - viewport_y_) / scale_y_;
+
+		scale_x_ *= factor;
+		scale_y_ *= factor;
+
+		left_ = wx - (x - viewport_x_) / scale_x_;
+		top_ = wy + (y - viewport_y_) / scale_y_;
+	}
+
+	point2d<float> world_to_screen(double x, double y) const
+	{
+		return point2d<float>(
+			static_cast<float>(viewport_x_ + (x - left_) * scale_x_),
+			static_cast<float>(viewport_y_ + (top_ - y) * scale_y_));
+	}
+
+	// same view with (left, top) moved to the world origin, for geometry relative to the camera
+	camera2d relative() const
+	{
+		return relative_to(left_, top_);
+	}
+
+	// same view with (x, y) moved to the world origin, for geometry relative to that point
+	camera2d relative_to(double x, double y) const
+	{
+		auto result = *this;
+		result.left_ -= x;
+		result.top_ -= y;
+		return result;
+	}
+
+	/*
+	 *  the same transformation as (scale_x, scale_y, translate_x, translate_y),
+	 *  screen = world * scale + translate, for the instanced renderer
+	 */
+	std::array<float, 4> world_to_screen() const
+	{
+		return {
+			static_cast<float>(scale_x_),
+			static_cast<float>(-scale_y_),
+			static_cast<float>(viewport_x_ - left_ * scale_x_),
+			static_cast<float>(viewport_y_ + top_ * scale_y_)
+		};
+	}
+};
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+namespace fib {
+
+namespace detail { struct cancellation_state; }
+
+/*
+ *  cooperative cancellation. Whoever starts a job keeps the
+ *  cancellation_source and hands its token to the job, which polls it at
+ *  chunk boundaries and returns early, leaving its output incomplete. A
+ *  default constructed token is never cancelled, so it costs a null check
+ *  where nobody asked for cancellation.
+ */
+class cancellation_token
+{
+private:
+	std::shared_ptr<detail::cancellation_state const> state_{};
+
+public:
+	cancellation_token() = default;
+	explicit cancellation_token(std::shared_ptr<detail::cancellation_state const> state) : state_(std::move(state)) {}
+
+	bool cancelled() const;
+};
+
+namespace detail {
+
+struct cancellation_state
+{
+	std::atomic<bool> cancelled{ false };
+	cancellation_token parent{};
+};
+
+}
+
+inline bool cancellation_token::cancelled() const
+{
+	return state_ != nullptr && (state_->cancelled.load(std::memory_order_relaxed) || state_->parent.cancelled());
+}
+
+/*
+ *  one per job, a new job gets a new source so a late cancel cannot hit it.
+ *  A source made from a token is also cancelled with that token, a stage
+ *  can stop the rest of its job without touching the caller's source.
+ */
+class cancellation_source
+{
+private:
+	std::shared_ptr<detail::cancellation_state> state_ = std::make_shared<detail::cancellation_state>();
+
+public:
+	cancellation_source() = default;
+	explicit cancellation_source(cancellation_token parent) { state_->parent = std::move(parent); }
+
+	cancellation_token token() const { return cancellation_token{ state_ }; }
+	void cancel() { state_->cancelled = true; }
+	bool cancelled() const { return token().cancelled(); }
+};
+
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <chrono>
+#include <filesystem>
+#include <system_error>
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+namespace fib {
+
+struct file_metadata
+{
+	bool exists = false;          // and is a regular file
+	std::uint64_t size = 0;
+	std::int64_t modified = 0;    // file clock ticks, only compared
+	std::uint64_t version = 0;    // bumped whenever the above changed
+};
+
+/*
+ *  cached metadata of one file, so the ui can ask every frame without
+ *  touching the file system. On linux an inotify watch on the directory
+ *  tells when to look again: the writers replace files by renaming over
+ *  them, which a watch on the file itself would lose track of. Elsewhere,
+ *  or when inotify is unavailable, the file is stat()ed every
+ *  poll_interval instead.
+ */
+class file_watcher
+{
+private:
+	using clock = std::chrono::steady_clock;
+
+	std::string filename_{};
+	std::string leaf_{};
+	file_metadata metadata_{};
+	std::chrono::milliseconds poll_interval_;
+	clock::time_point next_poll_{};
+	bool watching_ = false;
+
+#if defined(__linux__)
+	int inotify_ = -1;
+	int watch_ = -1;
+#endif
+
+	void refresh()
+	{
+		std::error_code error{};
+		auto const path = std::filesystem::path(filename_);
+
+		file_metadata current{};
+		current.exists = !filename_.empty() && std::filesystem::is_regular_file(path, error);
+		if (current.exists)
+		{
+			current.size = std::filesystem::file_size(path, error);
+			current.modified = static_cast<std::int64_t>(std::filesystem::last_write_time(path, error).time_since_epoch().count());
+		}
+
+		if (current.exists != metadata_.exists || current.size != metadata_.size || current.modified != metadata_.modified)
+		{
+			current.version = metadata_.version + 1;
+			metadata_ = current;
+		}
+	}
+
+	void unwatch()
+	{
+#if defined(__linux__)
+		if (watch_ >= 0)
+			inotify_rm_watch(inotify_, watch_);
+		watch_ = -1;
+#endif
+		watching_ = false;
+	}
+
+	// true when the watch reported something about the file, or lost the directory
+	bool drain_events()
+	{
+		bool changed = false;
+#if defined(__linux__)
+		alignas(inotify_event) char events[4096];
+		while (true)
+		{
+			auto const bytes = read(inotify_, events, sizeof(events));
+			if (bytes <= 0)
+				break;
+
+			for (auto p = events; p < events + bytes;)
+			{
+				auto const* event = reinterpret_cast<inotify_event const*>(p);
+				p += sizeof(inotify_event) + event->len;
+
+				// left over from a directory watched before
+				if (event->wd != watch_)
+					continue;
+
+				if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+				{
+					// the directory is gone, polling takes over
+					watch_ = -1;
+					watching_ = false;
+					changed = true;
+				}
+				else if ((event->mask & IN_Q_OVERFLOW) || (event->len > 0 && leaf_ == event->name))
+				{
+					changed = true;
+				}
+			}
+		}
+#endif
+		return changed;
+	}
+
+public:
+	explicit file_watcher(std::chrono::milliseconds poll_interval = std::chrono::milliseconds(500)) : poll_interval_(poll_interval)
+	{
+#if defined(__linux__)
+		inotify_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+	}
+
+	file_watcher(file_watcher const&) = delete;
+	file_watcher& operator=(file_watcher const&) = delete;
+
+	~file_watcher()
+	{
+		unwatch();
+#if defined(__linux__)
+		if (inotify_ >= 0)
+			close(inotify_);
+#endif
+	}
+
+	// cheap when filename did not change, the ui calls it with its text field every frame
+	void watch(std::string_view filename)
+	{
+		if (filename == filename_)
+			return;
+
+		unwatch();
+		filename_ = std::string(filename);
+		auto const path = std::filesystem::path(filename_);
+		leaf_ = path.filename().string();
+
+#if defined(__linux__)
+		if (inotify_ >= 0 && !filename_.empty())
+		{
+			auto const directory = path.has_parent_path() ? path.parent_path().string() : std::string(".");
+			watch_ = inotify_add_watch(inotify_, directory.c_str(),
+				IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF);
+			watching_ = watch_ >= 0;
+		}
+#endif
+
+		refresh();
+		next_poll_ = clock::now() + poll_interval_;
+	}
+
+	// picks up changes since the last call, true when the metadata changed
+	bool update()
+	{
+		auto const version = metadata_.version;
+
+		if (watching_)
+		{
+			if (drain_events())
+				refresh();
+		}
+		else
+		{
+			auto const now = clock::now();
+			if (now >= next_poll_)
+			{
+				refresh();
+				next_poll_ = now + poll_interval_;
+			}
+		}
+
+		return metadata_.version != version;
+	}
+
+	file_metadata const& metadata() const { return metadata_; }
+
+	// false while the file is polled instead
+	bool event_driven() const { return watching_; }
+};
+
+}
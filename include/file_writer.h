@@ -0,0 +1,144 @@
+#pragma once
+
+#include <stdio.h>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace fib {
+
+/*
+ *  append only file with one large user space buffer, the exporters format
+ *  straight into reserve()d space and the file only sees buffer sized writes.
+ *  The buffer is page aligned so whole buffer writes start on a page.
+ */
+class buffered_file_writer
+{
+private:
+	static constexpr std::size_t alignment = 4096;
+
+	struct aligned_delete
+	{
+		void operator()(char* p) const { ::operator delete[](p, std::align_val_t(alignment)); }
+	};
+
+	static char* allocate(std::size_t n) { return new (std::align_val_t(alignment)) char[n]; }
+
+	FILE* file_ = nullptr;
+	std::unique_ptr<char[], aligned_delete> buffer_{};
+	std::size_t capacity_ = 0;
+	std::size_t size_ = 0;
+	std::size_t written_ = 0;
+	bool failed_ = false;
+
+public:
+	explicit buffered_file_writer(std::size_t capacity = std::size_t(1) << 20) : buffer_(allocate(capacity)), capacity_(capacity) {}
+	buffered_file_writer(buffered_file_writer const&) = delete;
+	buffered_file_writer& operator=(buffered_file_writer const&) = delete;
+	~buffered_file_writer() { close(); }
+
+	bool open(std::string const& filename)
+	{
+		close();
+		file_ = fopen(filename.c_str(), "wb");
+		failed_ = file_ == nullptr;
+		written_ = 0;
+		return !failed_;
+	}
+
+	bool close()
+	{
+		if (file_ == nullptr)
+			return !failed_;
+
+		flush();
+		if (fclose(file_) != 0)
+			failed_ = true;
+		file_ = nullptr;
+		return !failed_;
+	}
+
+	bool flush()
+	{
+		if (file_ != nullptr && size_ > 0)
+		{
+			if (fwrite(buffer_.get(), 1, size_, file_) != size_)
+				failed_ = true;
+			written_ += size_;
+		}
+		size_ = 0;
+		return !failed_;
+	}
+
+	// contiguous space for at least n bytes, commit() what was used
+	char* reserve(std::size_t n)
+	{
+		if (capacity_ - size_ < n)
+			flush();
+		if (capacity_ < n)
+		{
+			buffer_.reset(allocate(n));
+			capacity_ = n;
+		}
+		return buffer_.get() + size_;
+	}
+
+	void commit(std::size_t n) { size_ += n; }
+
+	// anything larger than the buffer goes straight to the file
+	void write(std::string_view text)
+	{
+		if (text.size() > capacity_ && file_ != nullptr)
+		{
+			flush();
+			if (fwrite(text.data(), 1, text.size(), file_) != text.size())
+				failed_ = true;
+			written_ += text.size();
+			return;
+		}
+
+		std::memcpy(reserve(text.size()), text.data(), text.size());
+		commit(text.size());
+	}
+
+	// bytes handed to the file so far plus what is still buffered
+	std::size_t size() const { return written_ + size_; }
+	bool failed() const { return failed_; }
+};
+
+struct file_section
+{
+	void const* data;
+	std::size_t bytes;
+};
+
+/*
+ *  the sections back to back, written next to the target and renamed over
+ *  it, so readers never see a partial file and a mapping of the old file,
+ *  possibly the source of the data, stays valid
+ */
+inline bool replace_file(std::string const& filename, std::vector<file_section> const& sections)
+{
+	auto const temporary = filename + ".tmp";
+	{
+		buffered_file_writer out{ std::size_t(4) << 20 };
+		if (!out.open(temporary))
+			return false;
+
+		for (auto const& section : sections)
+			out.write(std::string_view(static_cast<char const*>(section.data), section.bytes));
+		if (!out.close())
+			return false;
+	}
+
+#if defined(_WIN32)
+	// rename does not replace on windows
+	remove(filename.c_str());
+#endif
+	return rename(temporary.c_str(), filename.c_str()) == 0;
+}
+
+}
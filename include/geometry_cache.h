@@ -0,0 +1,174 @@
+#pragma once
+
+#include "spiral.h"
+#include "sequence_file.h"
+#include "mapped_file.h"
+#include "file_writer.h"
+
+#include <stdio.h>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <filesystem>
+#include <system_error>
+
+namespace fib {
+
+/*
+ *  .geo geometry cache, everything the viewer computes from a sequence:
+ *
+ *    geometry_header   64 bytes, native byte order
+ *    padding           zeros up to geometry_alignment
+ *    squares           square x squares, outermost first, the instance buffer layout
+ *    padding           zeros up to geometry_alignment
+ *    points            spiral_index::point x points, the double precision spiral for deep zoom
+ *
+ *  Both arrays start on a page, a mapping of the file hands them out in
+ *  place. The key hashes the source terms and every parameter the geometry
+ *  depends on, a file is only used when its key matches, so it is never
+ *  stale, and the file name is the key so a lookup is a single open.
+ */
+struct geometry_header
+{
+	char magic[8];              // "FIBGEO\r\n"
+	std::uint32_t byte_order;   // 0x01020304 as written
+	std::uint32_t version;
+	std::uint64_t key;          // geometry_cache_key the geometry was built for
+	std::uint64_t squares;
+	std::uint64_t points;       // of the spiral_index
+	float min_x, min_y;         // bounds of the squares
+	float max_x, max_y;
+	std::uint32_t square_bytes; // sizeof(square)
+	std::uint32_t point_bytes;  // sizeof(spiral_index::point)
+};
+static_assert(sizeof(geometry_header) == 64, "the header is part of the file format");
+
+constexpr char geometry_magic[8] = { 'F', 'I', 'B', 'G', 'E', 'O', '\r', '\n' };
+constexpr std::uint32_t geometry_version = 1;
+constexpr std::uint64_t geometry_alignment = 4096;
+constexpr char geometry_cache_directory[] = "fibonacci.cache";
+
+inline std::uint64_t geometry_align(std::uint64_t offset)
+{
+	return (offset + geometry_alignment - 1) / geometry_alignment * geometry_alignment;
+}
+
+inline std::uint64_t geometry_squares_offset(geometry_header const&)
+{
+	return geometry_alignment;
+}
+
+inline std::uint64_t geometry_points_offset(geometry_header const& header)
+{
+	return geometry_align(geometry_squares_offset(header) + header.squares * sizeof(square));
+}
+
+/*
+ *  terms_checksum is the sequence_checksum of all terms of the source, the
+ *  one stored in a version 1 .bin header will do, first is the term the
+ *  spiral starts from
+ */
+inline std::uint64_t geometry_cache_key(std::uint64_t terms_checksum, std::uint64_t count, std::uint64_t first, std::uint32_t color)
+{
+	std::uint64_t const parameters[] = { terms_checksum, count, first, color, geometry_version, sizeof(square) };
+	return sequence_checksum(parameters, sizeof(parameters));
+}
+
+inline std::string geometry_cache_filename(std::uint64_t key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.geo", (unsigned long long)key);
+	return (std::filesystem::path(geometry_cache_directory) / name).string();
+}
+
+// creates the cache directory when needed, replaces the file like the sequence writers do
+inline bool write_geometry_cache(std::string const& filename, std::uint64_t key,
+	float min_x, float min_y, float max_x, float max_y,
+	square const* squares, std::size_t square_count,
+	spiral_index::point const* points, std::size_t point_count)
+{
+	std::error_code error{};
+	auto const directory = std::filesystem::path(filename).parent_path();
+	if (!directory.empty())
+		std::filesystem::create_directories(directory, error);
+
+	geometry_header header{};
+	std::memcpy(header.magic, geometry_magic, sizeof(header.magic));
+	header.byte_order = sequence_byte_order;
+	header.version = geometry_version;
+	header.key = key;
+	header.squares = square_count;
+	header.points = point_count;
+	header.min_x = min_x; header.min_y = min_y;
+	header.max_x = max_x; header.max_y = max_y;
+	header.square_bytes = sizeof(square);
+	header.point_bytes = sizeof(spiral_index::point);
+
+	static char const padding[geometry_alignment] = {};
+	auto const squares_end = geometry_squares_offset(header) + square_count * sizeof(square);
+	return replace_file(filename, {
+		{ &header, sizeof(header) },
+		{ padding, geometry_squares_offset(header) - sizeof(header) },
+		{ squares, square_count * sizeof(square) },
+		{ padding, geometry_points_offset(header) - squares_end },
+		{ points, point_count * sizeof(spiral_index::point) } });
+}
+
+/*
+ *  a .geo file straight from the mapping. A missing file is a quiet miss,
+ *  a file that does not match the key or its own size is reported and
+ *  missed as well, the caller builds the geometry and writes it again.
+ */
+class mapped_geometry
+{
+private:
+	mapped_file file_{};
+	geometry_header header_{};
+
+public:
+	bool open(std::string const& filename, std::uint64_t key)
+	{
+		close();
+		if (!file_.open(filename))
+			return false;
+
+		if (file_.size() >= sizeof(header_))
+			std::memcpy(&header_, file_.data(), sizeof(header_));
+
+		auto const valid = file_.size() >= sizeof(header_) &&
+			std::memcmp(header_.magic, geometry_magic, sizeof(header_.magic)) == 0 &&
+			header_.byte_order == sequence_byte_order &&
+			header_.version == geometry_version &&
+			header_.square_bytes == sizeof(square) &&
+			header_.point_bytes == sizeof(spiral_index::point) &&
+			file_.size() == geometry_points_offset(header_) + header_.points * sizeof(spiral_index::point);
+
+		if (!valid || header_.key != key)
+		{
+			fprintf(stderr, "'%s' is not a geometry cache for this sequence, rebuilding it\n", filename.c_str());
+			close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void close()
+	{
+		file_.close();
+		header_ = geometry_header{};
+	}
+
+	geometry_header const& header() const { return header_; }
+
+	std::size_t size() const { return static_cast<std::size_t>(header_.squares); }
+	square const* begin() const { return reinterpret_cast<square const*>(file_.data() + geometry_squares_offset(header_)); }
+	square const* end() const { return begin() + size(); }
+
+	spiral_index::point const* points_begin() const { return reinterpret_cast<spiral_index::point const*>(file_.data() + geometry_points_offset(header_)); }
+	spiral_index::point const* points_end() const { return points_begin() + header_.points; }
+};
+
+}
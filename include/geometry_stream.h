@@ -0,0 +1,167 @@
+#pragma once
+
+#include "spiral.h"
+#include "spsc_ring.h"
+#include "cancellation.h"
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <utility>
+
+namespace fib {
+
+/*
+ *  hands square chunks from the worker to the ui thread while the spiral is
+ *  still being built. The worker publishes the bounds first and then the
+ *  squares from the outermost inwards, so the first frame after publish()
+ *  already shows the spiral at its final extent and later frames only add
+ *  ever smaller squares to it. reset() tags the stream with the job that
+ *  publishes next, the ui only takes from the job it waits for.
+ *
+ *  The chunks go through a lock-free ring, one worker publishes and the ui
+ *  takes, the mutex only guards what changes once per job. Chunks of an
+ *  earlier job still in the ring carry its tag and are dropped by take().
+ */
+class geometry_stream
+{
+private:
+	struct tagged_chunk
+	{
+		std::uint64_t job = 0;
+		std::vector<square> squares{};
+	};
+
+	// chunks in flight, the worker waits for the ui beyond that
+	static constexpr std::size_t ring_chunks = 1024;
+
+	mutable std::mutex mutex_{};
+	float min_x_ = 0.f, min_y_ = 0.f, max_x_ = 0.f, max_y_ = 0.f;
+	bool has_bounds_ = false;
+	bool cancelled_ = false;
+	std::uint64_t job_ = 0;
+
+	// only touched by the worker
+	std::uint64_t publishing_job_ = 0;
+
+	spsc_ring<tagged_chunk> ring_{ ring_chunks };
+
+public:
+	// worker: before the first publish of a job
+	void reset(std::uint64_t job = 0)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		job_ = job;
+		publishing_job_ = job;
+		has_bounds_ = false;
+		cancelled_ = false;
+	}
+
+	// the worker gave up, whatever it published so far is not to be shown
+	void cancel()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		cancelled_ = true;
+	}
+
+	bool cancelled() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return cancelled_;
+	}
+
+	std::uint64_t job() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return job_;
+	}
+
+	void publish_bounds(float min_x, float min_y, float max_x, float max_y)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		min_x_ = min_x; min_y_ = min_y;
+		max_x_ = max_x; max_y_ = max_y;
+		has_bounds_ = true;
+	}
+
+	/*
+	 *  worker: waits while the ring is full, the ui takes everything once a
+	 *  frame. False when cancel fired first, the chunk is then dropped.
+	 */
+	bool publish(std::vector<square> chunk, cancellation_token const& cancel = {})
+	{
+		tagged_chunk tagged{ publishing_job_, std::move(chunk) };
+		for (int attempt = 0; !ring_.try_push(std::move(tagged)); ++attempt)
+		{
+			if (cancel.cancelled())
+				return false;
+
+			// a frame is a long time to spin, after a few yields sleep in small steps
+			if (attempt < 64)
+				std::this_thread::yield();
+			else
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+		return true;
+	}
+
+	// false until the worker published its bounds
+	bool bounds(float& min_x, float& min_y, float& max_x, float& max_y) const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (!has_bounds_)
+			return false;
+
+		min_x = min_x_; min_y = min_y_;
+		max_x = max_x_; max_y = max_y_;
+		return true;
+	}
+
+	// ui: moves the chunks of the current job published since the last call into out, in publish order
+	std::size_t take(std::vector<std::vector<square>>& out)
+	{
+		std::uint64_t job = 0;
+		bool cancelled = false;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			job = job_;
+			cancelled = cancelled_;
+		}
+
+		std::size_t count = 0;
+		tagged_chunk tagged{};
+		while (ring_.try_pop(tagged))
+		{
+			if (tagged.job != job || cancelled)
+				continue;
+
+			out.push_back(std::move(tagged.squares));
+			++count;
+		}
+		return count;
+	}
+
+	/*
+	 *  ui: drops the chunks of earlier or cancelled jobs but leaves the
+	 *  current job's for take(). Keeps the ring from filling up with chunks
+	 *  nobody will take while the stream is not shown.
+	 */
+	void drop_stale()
+	{
+		std::uint64_t job = 0;
+		bool cancelled = false;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			job = job_;
+			cancelled = cancelled_;
+		}
+
+		tagged_chunk dropped{};
+		for (auto* front = ring_.front(); front != nullptr && (front->job != job || cancelled); front = ring_.front())
+			ring_.try_pop(dropped);
+	}
+};
+
+}
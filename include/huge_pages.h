@@ -0,0 +1,234 @@
+#pragma once
+
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <atomic>
+#include <string_view>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace fib {
+
+enum class page_mode
+{
+	standard,      // operator new, whatever the c++ runtime does
+	transparent,   // anonymous mappings advised MADV_HUGEPAGE, the kernel backs them with 2 MB pages where it can
+	hugetlb,       // MAP_HUGETLB from the reserved pool (vm.nr_hugepages), transparent when that is empty
+};
+
+// allocations from huge_page_threshold bytes on get their own mapping
+constexpr std::size_t huge_page_size = std::size_t(2) << 20;
+constexpr std::size_t huge_page_threshold = huge_page_size;
+
+struct page_stats
+{
+	std::uint64_t mapped_bytes = 0;     // ever mapped for huge pages
+	std::uint64_t hugetlb_bytes = 0;    // of those, from the reserved pool
+	std::uint64_t fallbacks = 0;        // hugetlb requests the pool could not serve
+};
+
+namespace detail {
+
+inline page_mode& default_page_mode()
+{
+#if defined(__linux__)
+	static page_mode mode = page_mode::transparent;
+#else
+	static page_mode mode = page_mode::standard;
+#endif
+	return mode;
+}
+
+struct page_counters
+{
+	std::atomic<std::uint64_t> mapped_bytes{ 0 };
+	std::atomic<std::uint64_t> hugetlb_bytes{ 0 };
+	std::atomic<std::uint64_t> fallbacks{ 0 };
+};
+
+inline page_counters& page_counters_instance() { static page_counters counters{}; return counters; }
+
+inline std::size_t huge_page_round_up(std::size_t bytes) { return (bytes + huge_page_size - 1) / huge_page_size * huge_page_size; }
+
+#if defined(__linux__)
+
+/*
+ *  a huge page aligned mapping of whole huge pages. The kernel only backs
+ *  aligned 2 MB ranges with huge pages, so a plain mapping is made one page
+ *  larger and trimmed to the aligned part.
+ */
+inline void* map_huge_pages(std::size_t bytes, page_mode mode)
+{
+	auto& counters = page_counters_instance();
+	// reserved pages are claimed at mmap() time, a short pool fails here rather than on first touch
+	if (mode == page_mode::hugetlb)
+	{
+		auto* data = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (data != MAP_FAILED)
+		{
+			counters.mapped_bytes += bytes;
+			counters.hugetlb_bytes += bytes;
+			return data;
+		}
+		++counters.fallbacks;
+	}
+
+	auto* raw = mmap(nullptr, bytes + huge_page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (raw == MAP_FAILED)
+		return nullptr;
+
+	auto const address = reinterpret_cast<std::uintptr_t>(raw);
+	auto const aligned = (address + huge_page_size - 1) / huge_page_size * huge_page_size;
+	if (aligned != address)
+		munmap(raw, aligned - address);
+	munmap(reinterpret_cast<void*>(aligned + bytes), address + huge_page_size - aligned);
+
+	auto* data = reinterpret_cast<void*>(aligned);
+	madvise(data, bytes, MADV_HUGEPAGE);
+	counters.mapped_bytes += bytes;
+	return data;
+}
+
+// munmap does not care whether the pages came from the reserved pool
+inline void unmap_huge_pages(void* data, std::size_t bytes)
+{
+	munmap(data, bytes);
+}
+
+#endif
+
+}
+
+// for the allocations made from now on, buffers that exist keep their pages
+inline void set_page_mode(page_mode mode) { detail::default_page_mode() = mode; }
+inline page_mode get_page_mode() { return detail::default_page_mode(); }
+
+inline bool parse_page_mode(std::string_view name, page_mode& mode)
+{
+	if (name == "standard") mode = page_mode::standard;
+	else if (name == "transparent") mode = page_mode::transparent;
+	else if (name == "hugetlb") mode = page_mode::hugetlb;
+	else return false;
+	return true;
+}
+
+inline char const* page_mode_name(page_mode mode)
+{
+	return mode == page_mode::transparent ? "transparent" : mode == page_mode::hugetlb ? "hugetlb" : "standard";
+}
+
+inline page_stats get_page_stats()
+{
+	auto const& counters = detail::page_counters_instance();
+	return page_stats{ counters.mapped_bytes.load(), counters.hugetlb_bytes.load(), counters.fallbacks.load() };
+}
+
+/*
+ *  allocator for the multi GB buffers: the big integer terms and the spiral
+ *  points. Allocations of at least huge_page_threshold bytes get their own
+ *  huge page aligned mapping in the current page_mode, smaller ones and
+ *  everything off linux come from operator new. A TLB entry then covers
+ *  2 MB instead of 4 kB, which is what a walk over a few GB of terms runs
+ *  out of first.
+ *
+ *  resize() without a value leaves the new elements uninitialized, so the
+ *  pages are not touched until the buffer is filled: whichever thread
+ *  writes a page first decides which numa node it lives on, see
+ *  first_touch(). The allocator keeps the page_mode that was current when
+ *  it was made, a container frees with the mode it allocated with however
+ *  the mode changes meanwhile.
+ */
+template <class T>
+class huge_page_allocator
+{
+public:
+	using value_type = T;
+	using propagate_on_container_move_assignment = std::true_type;
+	using propagate_on_container_swap = std::true_type;
+
+	page_mode mode = get_page_mode(); // public for the rebinding constructor
+
+	huge_page_allocator() = default;
+	template <class U> huge_page_allocator(huge_page_allocator<U> const& other) noexcept : mode(other.mode) {}
+
+	T* allocate(std::size_t count)
+	{
+		auto const bytes = count * sizeof(T);
+		if (mapped(bytes))
+		{
+#if defined(__linux__)
+			if (auto* data = detail::map_huge_pages(detail::huge_page_round_up(bytes), mode))
+				return static_cast<T*>(data);
+#endif
+			throw std::bad_alloc();
+		}
+		return static_cast<T*>(::operator new(bytes));
+	}
+
+	void deallocate(T* data, std::size_t count) noexcept
+	{
+		auto const bytes = count * sizeof(T);
+		if (mapped(bytes))
+		{
+#if defined(__linux__)
+			detail::unmap_huge_pages(data, detail::huge_page_round_up(bytes));
+#endif
+			return;
+		}
+		::operator delete(data);
+	}
+
+	// value initialization becomes default initialization, resize(n) does not touch the pages
+	template <class U>
+	void construct(U* p) noexcept(std::is_nothrow_default_constructible<U>::value) { ::new (static_cast<void*>(p)) U; }
+
+	template <class U, class... Args>
+	void construct(U* p, Args&&... args) { ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...); }
+
+	// either one frees what the other allocated
+	template <class U> bool operator==(huge_page_allocator<U> const& other) const noexcept { return mapped_modes() == other.mapped_modes(); }
+	template <class U> bool operator!=(huge_page_allocator<U> const& other) const noexcept { return !(*this == other); }
+
+	bool mapped_modes() const
+	{
+#if defined(__linux__)
+		return mode != page_mode::standard;
+#else
+		return false;
+#endif
+	}
+
+private:
+	bool mapped(std::size_t bytes) const { return bytes >= huge_page_threshold && mapped_modes(); }
+};
+
+/*
+ *  fills count elements with value in huge page sized slices, pulled from
+ *  a counter by threads threads, 0 for the whole pool. On a numa machine
+ *  the first write to a page places it on the writer's node, so a buffer
+ *  filled this way is spread over the nodes of the pool threads instead of
+ *  landing on the node of the one thread that allocated it, and no node's
+ *  memory bandwidth ends up serving every thread.
+ */
+template <class T>
+void first_touch(T* data, std::size_t count, T const& value, unsigned int threads = 0)
+{
+	constexpr std::size_t slice = std::max<std::size_t>(huge_page_size / sizeof(T), 1);
+	auto const slices = (count + slice - 1) / slice;
+	std::atomic<std::size_t> next{ 0 };
+	run_parallel(static_cast<unsigned int>(std::min<std::size_t>(threads != 0 ? threads : default_pool().size() + 1, std::max<std::size_t>(slices, 1))), [&]()
+	{
+		for (auto k = next++; k < slices; k = next++)
+			std::fill(data + k * slice, data + std::min(count, (k + 1) * slice), value);
+	});
+}
+
+}
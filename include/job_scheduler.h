@@ -0,0 +1,302 @@
+#pragma once
+
+#include "thread_pool.h"
+#include "cancellation.h"
+
+#include <cstdint>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <exception>
+#include <algorithm>
+
+namespace fib {
+
+enum class job_status
+{
+	done,
+	cancelled,   // started, then cancelled, the result may be incomplete
+	superseded,  // replaced by a newer request before it started, never ran
+};
+
+struct job_timing
+{
+	double queued_ms = 0.;   // submit to start
+	double run_ms = 0.;      // start to finish
+};
+
+template <class Result>
+struct job_outcome
+{
+	std::uint64_t id = 0;
+	job_status status = job_status::done;
+	Result result{};
+	job_timing timing{};
+};
+
+template <class Result>
+struct job_ticket
+{
+	std::uint64_t id = 0;
+	bool deduplicated = false;   // an identical job was already in flight, this is its ticket
+	std::shared_future<job_outcome<Result>> outcome{};
+
+	bool valid() const { return outcome.valid(); }
+	bool ready() const { return outcome.valid() && outcome.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }
+};
+
+// what the job function gets besides its request
+struct job_context
+{
+	std::uint64_t id = 0;
+	cancellation_token cancel{};
+	thread_pool* pool = &default_pool(); // the one the job runs on, for the work it fans out
+};
+
+struct job_scheduler_options
+{
+	std::size_t max_running = 1;
+	bool coalesce = true;           // a new request replaces the queued ones and cancels the running ones
+	std::function<void()> finished{}; // on the pool thread once a job's outcome is ready, e.g. to wake an event loop
+};
+
+struct job_scheduler_stats
+{
+	std::uint64_t submitted = 0;
+	std::uint64_t deduplicated = 0;
+	std::uint64_t superseded = 0;
+	std::uint64_t cancelled = 0;
+	std::uint64_t done = 0;
+	job_timing last{};              // of the last job that ran
+	double total_run_ms = 0.;       // of all jobs that ran, done or cancelled
+};
+
+/*
+ *  runs jobs on the pool, each on its own copy of the request it was
+ *  submitted with, so the caller is free to change whatever it built the
+ *  request from. A request equal to one already queued or running gets
+ *  that job's ticket instead of a new job. With coalesce set every new
+ *  request replaces the queued ones, which finish as superseded without
+ *  running, and cancels the running ones, so a burst of edits ends up
+ *  running only the last of them.
+ *
+ *  Request needs operator==. The job function polls the token in its
+ *  context and returns early once it is cancelled.
+ */
+template <class Request, class Result>
+class job_scheduler
+{
+public:
+	using job_function = std::function<Result(Request const&, job_context const&)>;
+	using ticket = job_ticket<Result>;
+	using outcome = job_outcome<Result>;
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct job
+	{
+		std::uint64_t id = 0;
+		Request request;
+		cancellation_source cancel{};
+		std::promise<outcome> promise{};
+		std::shared_future<outcome> future{};
+		clock::time_point submitted{};
+		clock::time_point started{};
+	};
+
+	job_function function_;
+	job_scheduler_options options_;
+	thread_pool& pool_;
+
+	mutable std::mutex mutex_{};
+	std::condition_variable idle_{};
+	std::deque<std::shared_ptr<job>> queued_{};
+	std::vector<std::shared_ptr<job>> running_{};
+	std::uint64_t next_id_ = 1;
+	job_scheduler_stats stats_{};
+
+	static double milliseconds(clock::duration duration) { return std::chrono::duration<double, std::milli>(duration).count(); }
+
+	static ticket make_ticket(job const& j, bool deduplicated) { return ticket{ j.id, deduplicated, j.future }; }
+
+	// under the lock, the promise is kept until the lock is released
+	void supersede_queued(std::vector<std::shared_ptr<job>>& finished)
+	{
+		for (auto& j : queued_)
+		{
+			++stats_.superseded;
+			finished.push_back(std::move(j));
+		}
+		queued_.clear();
+	}
+
+	// under the lock
+	void start_queued()
+	{
+		while (!queued_.empty() && running_.size() < std::max<std::size_t>(options_.max_running, 1))
+		{
+			auto j = std::move(queued_.front());
+			queued_.pop_front();
+			j->started = clock::now();
+			running_.push_back(j);
+			pool_.post([this, j]() { run(j); });
+		}
+	}
+
+	void run(std::shared_ptr<job> const& j)
+	{
+		outcome result{};
+		result.id = j->id;
+		std::exception_ptr error{};
+		try
+		{
+			result.result = function_(j->request, job_context{ j->id, j->cancel.token(), &pool_ });
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+
+		auto const finished = clock::now();
+		result.status = j->cancel.cancelled() ? job_status::cancelled : job_status::done;
+		result.timing.queued_ms = milliseconds(j->started - j->submitted);
+		result.timing.run_ms = milliseconds(finished - j->started);
+
+		auto const timing = result.timing;
+		auto const status = result.status;
+		if (error)
+			j->promise.set_exception(error);
+		else
+			j->promise.set_value(std::move(result));
+
+		if (options_.finished)
+			options_.finished();
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		running_.erase(std::find(running_.begin(), running_.end(), j));
+		++(status == job_status::done ? stats_.done : stats_.cancelled);
+		stats_.last = timing;
+		stats_.total_run_ms += timing.run_ms;
+		start_queued();
+		// under the lock, the destructor may return as soon as it sees running_ empty
+		idle_.notify_all();
+	}
+
+	void finish_superseded(std::vector<std::shared_ptr<job>> const& finished)
+	{
+		auto const now = clock::now();
+		for (auto const& j : finished)
+		{
+			outcome result{};
+			result.id = j->id;
+			result.status = job_status::superseded;
+			result.timing.queued_ms = milliseconds(now - j->submitted);
+			j->promise.set_value(std::move(result));
+		}
+
+		if (!finished.empty() && options_.finished)
+			options_.finished();
+	}
+
+public:
+	explicit job_scheduler(job_function function, job_scheduler_options const& options = {}, thread_pool& pool = default_pool())
+		: function_(std::move(function)), options_(options), pool_(pool)
+	{
+	}
+
+	job_scheduler(job_scheduler const&) = delete;
+	job_scheduler& operator=(job_scheduler const&) = delete;
+
+	// cancels everything and waits for the running jobs, they call back into this
+	~job_scheduler()
+	{
+		cancel_all();
+		std::unique_lock<std::mutex> lock(mutex_);
+		idle_.wait(lock, [this]() { return running_.empty(); });
+	}
+
+	ticket submit(Request request)
+	{
+		std::vector<std::shared_ptr<job>> superseded{};
+		ticket result{};
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			++stats_.submitted;
+
+			// a cancelled job is no longer in flight, whatever it computes is thrown away
+			auto const same = [&request](std::shared_ptr<job> const& j) { return !j->cancel.cancelled() && j->request == request; };
+			auto const queued = std::find_if(queued_.begin(), queued_.end(), same);
+			auto const running = std::find_if(running_.begin(), running_.end(), same);
+			if (queued != queued_.end() || running != running_.end())
+			{
+				++stats_.deduplicated;
+				return make_ticket(queued != queued_.end() ? **queued : **running, true);
+			}
+
+			if (options_.coalesce)
+			{
+				supersede_queued(superseded);
+				for (auto const& j : running_)
+					j->cancel.cancel();
+			}
+
+			auto j = std::make_shared<job>(job{ next_id_++, std::move(request) });
+			j->future = j->promise.get_future().share();
+			j->submitted = clock::now();
+			result = make_ticket(*j, false);
+			queued_.push_back(std::move(j));
+			start_queued();
+		}
+
+		finish_superseded(superseded);
+		return result;
+	}
+
+	// supersedes the job with this id if it is queued, cancels it if it is running
+	void cancel(std::uint64_t id)
+	{
+		std::vector<std::shared_ptr<job>> superseded{};
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			auto const queued = std::find_if(queued_.begin(), queued_.end(), [id](std::shared_ptr<job> const& j) { return j->id == id; });
+			if (queued != queued_.end())
+			{
+				++stats_.superseded;
+				superseded.push_back(std::move(*queued));
+				queued_.erase(queued);
+			}
+
+			for (auto const& j : running_)
+			{
+				if (j->id == id)
+					j->cancel.cancel();
+			}
+		}
+		finish_superseded(superseded);
+	}
+
+	// supersedes the queued jobs and cancels the running ones
+	void cancel_all()
+	{
+		std::vector<std::shared_ptr<job>> superseded{};
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			supersede_queued(superseded);
+			for (auto const& j : running_)
+				j->cancel.cancel();
+		}
+		finish_superseded(superseded);
+	}
+
+	std::size_t queued() const { std::lock_guard<std::mutex> lock(mutex_); return queued_.size(); }
+	std::size_t running() const { std::lock_guard<std::mutex> lock(mutex_); return running_.size(); }
+	job_scheduler_stats stats() const { std::lock_guard<std::mutex> lock(mutex_); return stats_; }
+};
+
+}
@@ -0,0 +1,224 @@
+#pragma once
+
+#include "sequence_file.h"
+
+#include <stdio.h>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace fib {
+
+/*
+ *  read only view of a whole file. Nothing is read up front, pages come in
+ *  on first touch and the kernel may drop them again under memory pressure,
+ *  so mapping a multi GB file costs only for the parts that get used.
+ */
+class mapped_file
+{
+private:
+	void* data_ = nullptr;
+	std::size_t size_ = 0;
+
+public:
+	mapped_file() = default;
+	mapped_file(mapped_file const&) = delete;
+	mapped_file& operator=(mapped_file const&) = delete;
+	~mapped_file() { close(); }
+
+	bool open(std::string const& filename);
+	void close();
+
+	// the whole file will be read front to back once, read ahead aggressively and drop pages behind
+	void advise_sequential() const;
+
+	unsigned char const* data() const { return static_cast<unsigned char const*>(data_); }
+	std::size_t size() const { return size_; }
+};
+
+#if defined(_WIN32)
+
+inline bool mapped_file::open(std::string const& filename)
+{
+	close();
+
+	auto file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size{};
+	if (!GetFileSizeEx(file, &size))
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	// empty files cannot be mapped, they are an open mapping of nothing
+	if (size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return true;
+	}
+
+	// the view keeps the mapping and the file alive
+	auto mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (mapping == NULL)
+		return false;
+
+	data_ = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (data_ == nullptr)
+		return false;
+
+	size_ = static_cast<std::size_t>(size.QuadPart);
+	return true;
+}
+
+inline void mapped_file::close()
+{
+	if (data_ != nullptr)
+		UnmapViewOfFile(data_);
+	data_ = nullptr;
+	size_ = 0;
+}
+
+inline void mapped_file::advise_sequential() const
+{
+	// FILE_FLAG_SEQUENTIAL_SCAN at open time is the closest windows has
+}
+
+#else
+
+inline bool mapped_file::open(std::string const& filename)
+{
+	close();
+
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st{};
+	if (fstat(fd, &st) != 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	// empty files cannot be mapped, they are an open mapping of nothing
+	if (st.st_size == 0)
+	{
+		::close(fd);
+		return true;
+	}
+
+	// the mapping keeps the file alive
+	auto* data = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (data == MAP_FAILED)
+		return false;
+
+	data_ = data;
+	size_ = static_cast<std::size_t>(st.st_size);
+	return true;
+}
+
+inline void mapped_file::close()
+{
+	if (data_ != nullptr)
+		munmap(data_, size_);
+	data_ = nullptr;
+	size_ = 0;
+}
+
+inline void mapped_file::advise_sequential() const
+{
+	if (data_ != nullptr)
+		madvise(data_, size_, MADV_SEQUENTIAL);
+}
+
+#endif
+
+/*
+ *  int terms of a .bin file straight from the mapping, version 1 or legacy.
+ *  The header is checked against the file size, the checksum is only
+ *  verified when asked for because it touches every page.
+ */
+class mapped_sequence
+{
+private:
+	mapped_file file_{};
+	sequence_header header_{};
+	int const* terms_ = nullptr;
+
+public:
+	bool open(std::string_view filename, bool verify = false)
+	{
+		close();
+
+		auto const name = std::string(filename);
+		if (!file_.open(name))
+			return false;
+
+		if (!detail::parse_sequence_header(file_.data(), file_.size(), filename, header_))
+		{
+			close();
+			return false;
+		}
+
+		if (header_.type != element_type::signed_integer || header_.width != sizeof(int))
+		{
+			fprintf(stderr, "'%s' does not hold %d byte integers\n", name.c_str(), (int)sizeof(int));
+			close();
+			return false;
+		}
+
+		if (header_.encoding != sequence_encoding::raw)
+		{
+			fprintf(stderr, "'%s' is block coded, read_sequence decodes it\n", name.c_str());
+			close();
+			return false;
+		}
+
+		file_.advise_sequential();
+		terms_ = reinterpret_cast<int const*>(file_.data() + sequence_data_offset(header_));
+
+		if (verify && header_.version != 0 && sequence_checksum(terms_, size() * sizeof(int)) != header_.checksum)
+		{
+			fprintf(stderr, "'%s' fails its checksum\n", name.c_str());
+			close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void close()
+	{
+		file_.close();
+		header_ = sequence_header{};
+		terms_ = nullptr;
+	}
+
+	sequence_header const& header() const { return header_; }
+	std::size_t size() const { return static_cast<std::size_t>(header_.count); }
+	int const* begin() const { return terms_; }
+	int const* end() const { return terms_ + size(); }
+};
+
+}
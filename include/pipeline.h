@@ -0,0 +1,127 @@
+#pragma once
+
+#include "thread_pool.h"
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <utility>
+
+namespace fib {
+
+/*
+ *  a pipeline stage that consumes chunks on the pool while the thread
+ *  feeding it goes on with the previous stage. The stage body never
+ *  blocks: it is posted to the pool when the first chunk arrives, consumes
+ *  chunks until its queue is empty and returns, and push() posts it again
+ *  later. This is how a coroutine suspended on an empty channel behaves,
+ *  the pool it is given is the executor it resumes on. push() blocks
+ *  while capacity chunks are waiting, which holds the feeding stage back
+ *  to the pace of this one.
+ *
+ *  The feeding thread runs pool tasks while it waits, so a pool of one
+ *  thread, or one busy with the job feeding the stage, still gets through.
+ *  Chunks are consumed in push order, one at a time.
+ */
+template <class T>
+class pipeline_stage
+{
+public:
+	using consume_function = std::function<void(T&)>;
+
+private:
+	consume_function consume_;
+	std::size_t capacity_;
+	thread_pool& pool_;
+
+	std::mutex mutex_{};
+	std::condition_variable changed_{};
+	std::deque<T> queue_{};
+	bool scheduled_ = false;   // a body is posted or running
+	bool stopped_ = false;
+
+	// under the lock
+	void resume()
+	{
+		if (scheduled_ || stopped_ || queue_.empty())
+			return;
+
+		scheduled_ = true;
+		pool_.post([this]() { run(); });
+	}
+
+	void run()
+	{
+		while (true)
+		{
+			T chunk{};
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				if (stopped_ || queue_.empty())
+				{
+					// suspended until the next push(), the owner may go away once this is seen
+					scheduled_ = false;
+					changed_.notify_all();
+					return;
+				}
+
+				chunk = std::move(queue_.front());
+				queue_.pop_front();
+				changed_.notify_all();
+			}
+
+			consume_(chunk);
+		}
+	}
+
+	template <class Predicate>
+	void wait_helping(std::unique_lock<std::mutex>& lock, Predicate&& done)
+	{
+		while (!done())
+		{
+			lock.unlock();
+			auto const helped = pool_.run_one();
+			lock.lock();
+			if (!helped && !done())
+				changed_.wait_for(lock, std::chrono::microseconds(100));
+		}
+	}
+
+public:
+	pipeline_stage(consume_function consume, std::size_t capacity, thread_pool& pool = default_pool())
+		: consume_(std::move(consume)), capacity_(std::max<std::size_t>(capacity, 1)), pool_(pool)
+	{
+	}
+
+	pipeline_stage(pipeline_stage const&) = delete;
+	pipeline_stage& operator=(pipeline_stage const&) = delete;
+
+	// drops what was not consumed yet
+	~pipeline_stage()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		stopped_ = true;
+		queue_.clear();
+		wait_helping(lock, [this]() { return !scheduled_; });
+	}
+
+	void push(T chunk)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		wait_helping(lock, [this]() { return queue_.size() < capacity_ || stopped_; });
+		queue_.push_back(std::move(chunk));
+		resume();
+	}
+
+	// waits until everything pushed so far was consumed
+	void finish()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		wait_helping(lock, [this]() { return queue_.empty() && !scheduled_; });
+	}
+};
+
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include "spiral.h"
+#include "thread_pool.h"
+#include "cancellation.h"
+
+#include <cstdint>
+#include <cmath>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+namespace fib {
+
+struct raster_options
+{
+	int width = 4096;
+	int height = 4096;
+	int tile_size = 256;
+	unsigned int threads = 0; // 0 picks std::thread::hardware_concurrency()
+	int thickness = 1;        // line width in pixels
+	bool arcs = true;
+	std::uint8_t background = 0;
+	std::uint8_t foreground = 255;
+	cancellation_token cancel{}; // checked between tiles
+};
+
+// 8 bit grayscale, rows top to bottom, left uninitialized until rasterized
+struct raster_image
+{
+	int width = 0, height = 0;
+	std::unique_ptr<std::uint8_t[]> pixels{};
+};
+
+struct raster_stats
+{
+	double seconds = 0.;
+	unsigned int threads = 0;
+	std::size_t tiles = 0;
+	double megapixels_per_second = 0.;
+	bool cancelled = false;   // the image is incomplete
+};
+
+namespace detail {
+
+/*
+ *  square in pixel space (y down), x0 <= x1 and y0 <= y1,
+ *  (cx, cy) is the corner holding the center of the quarter arc
+ */
+struct pixel_square
+{
+	double x0, y0, x1, y1;
+	double cx, cy;
+};
+
+struct tile
+{
+	int x0, y0, x1, y1; // [x0, x1) x [y0, y1)
+	std::uint8_t* pixels;
+	int stride;
+
+	void fill(int xa, int ya, int xb, int yb, std::uint8_t value) const
+	{
+		xa = std::max(xa, x0); xb = std::min(xb, x1 - 1);
+		ya = std::max(ya, y0); yb = std::min(yb, y1 - 1);
+		for (int y = ya; y <= yb; ++y)
+		{
+			if (xa <= xb)
+				std::fill(pixels + std::size_t(y) * stride + xa, pixels + std::size_t(y) * stride + xb + 1, value);
+		}
+	}
+};
+
+inline int to_pixel(double v) { return static_cast<int>(std::floor(v)); }
+
+inline void rasterize_tile(tile const& t, std::vector<pixel_square> const& squares, raster_options const& options)
+{
+	t.fill(t.x0, t.y0, t.x1 - 1, t.y1 - 1, options.background);
+
+	auto const thickness = std::max(options.thickness, 1);
+	auto const fg = options.foreground;
+
+	for (auto const& s : squares)
+	{
+		if (s.x1 + thickness < t.x0 || s.x0 >= t.x1 || s.y1 + thickness < t.y0 || s.y0 >= t.y1)
+			continue;
+
+		auto const x0 = to_pixel(s.x0), x1 = to_pixel(s.x1);
+		auto const y0 = to_pixel(s.y0), y1 = to_pixel(s.y1);
+
+		// outline
+		t.fill(x0, y0, x1 + thickness - 1, y0 + thickness - 1, fg);
+		t.fill(x0, y1, x1 + thickness - 1, y1 + thickness - 1, fg);
+		t.fill(x0, y0, x0 + thickness - 1, y1 + thickness - 1, fg);
+		t.fill(x1, y0, x1 + thickness - 1, y1 + thickness - 1, fg);
+
+		if (!options.arcs)
+			continue;
+
+		// quarter ellipse around (cx, cy), one vertical span per pixel column keeps it connected
+		auto const w = s.x1 - s.x0, h = s.y1 - s.y0;
+		if (w <= 0. || h <= 0.)
+			continue;
+
+		auto const direction = s.cy == s.y0 ? 1. : -1.;
+		auto arc_y = [&](double x)
+		{
+			auto u = std::min(std::abs(x - s.cx) / w, 1.);
+			return s.cy + direction * h * std::sqrt(1. - u * u);
+		};
+
+		auto const first_column = std::max(t.x0, x0);
+		auto const last_column = std::min(t.x1 - 1, x1);
+		for (int column = first_column; column <= last_column; ++column)
+		{
+			auto const ya = arc_y(std::max(double(column), s.x0));
+			auto const yb = arc_y(std::min(double(column + 1), s.x1));
+			t.fill(column, to_pixel(std::min(ya, yb)), column + thickness - 1, to_pixel(std::max(ya, yb)) + thickness - 1, fg);
+		}
+	}
+}
+
+}
+
+/*
+ *  tile parallel rasterization of the spiral squares and arcs. The spiral is
+ *  fitted into the image keeping its aspect ratio, tiles are handed out to
+ *  the threads through an atomic counter and every tile only writes its own
+ *  pixels, so no synchronization is needed past the counter.
+ */
+inline raster_stats rasterize(spiral_index const& index, raster_options const& options, raster_image& image)
+{
+	using clock = std::chrono::steady_clock;
+
+	raster_stats stats{};
+	if (image.width != options.width || image.height != options.height || !image.pixels)
+	{
+		image.width = options.width;
+		image.height = options.height;
+		image.pixels.reset(new std::uint8_t[std::size_t(options.width) * std::size_t(options.height)]);
+	}
+
+	auto const start = clock::now();
+
+	// world to pixel space
+	std::vector<detail::pixel_square> squares{};
+	if (index.size() > 0)
+	{
+		auto const b = index.total_bounds();
+		auto const world_width = std::max(b.max_x - b.min_x, 1e-300);
+		auto const world_height = std::max(b.max_y - b.min_y, 1e-300);
+		auto const margin = double(std::max(options.thickness, 1));
+		auto const scale = std::min((options.width - margin) / world_width, (options.height - margin) / world_height);
+		auto const offset_x = (options.width - margin - world_width * scale) / 2.;
+		auto const offset_y = (options.height - margin - world_height * scale) / 2.;
+
+		auto const& points = index.points();
+		squares.reserve(index.size());
+		for (std::size_t k = 0; k < index.size(); ++k)
+		{
+			auto const& p = points[k];
+			auto const& q = points[k + 1];
+			auto const orientation = make_square(p, q, 0u).orientation;
+
+			detail::pixel_square s{};
+			s.x0 = (std::min(p.x, q.x) - b.min_x) * scale + offset_x;
+			s.x1 = (std::max(p.x, q.x) - b.min_x) * scale + offset_x;
+			s.y0 = (b.max_y - std::max(p.y, q.y)) * scale + offset_y;
+			s.y1 = (b.max_y - std::min(p.y, q.y)) * scale + offset_y;
+			s.cx = orientation == 0 || orientation == 3 ? s.x0 : s.x1;
+			s.cy = orientation == 0 || orientation == 1 ? s.y1 : s.y0;
+			squares.push_back(s);
+		}
+	}
+
+	auto const tile_size = std::max(options.tile_size, 16);
+	auto const tiles_x = (options.width + tile_size - 1) / tile_size;
+	auto const tiles_y = (options.height + tile_size - 1) / tile_size;
+	stats.tiles = std::size_t(tiles_x) * std::size_t(tiles_y);
+
+	stats.threads = options.threads != 0 ? options.threads : std::max(std::thread::hardware_concurrency(), 1u);
+	stats.threads = static_cast<unsigned int>(std::min<std::size_t>(stats.threads, stats.tiles));
+
+	std::atomic<std::size_t> next_tile{ 0 };
+	auto work = [&]()
+	{
+		for (auto i = next_tile++; i < stats.tiles && !options.cancel.cancelled(); i = next_tile++)
+		{
+			detail::tile t{};
+			t.x0 = int(i % tiles_x) * tile_size;
+			t.y0 = int(i / tiles_x) * tile_size;
+			t.x1 = std::min(t.x0 + tile_size, options.width);
+			t.y1 = std::min(t.y0 + tile_size, options.height);
+			t.pixels = image.pixels.get();
+			t.stride = options.width;
+			detail::rasterize_tile(t, squares, options);
+		}
+	};
+
+	run_parallel(stats.threads, work);
+
+	stats.cancelled = options.cancel.cancelled();
+	stats.seconds = std::chrono::duration<double>(clock::now() - start).count();
+	stats.megapixels_per_second = double(options.width) * double(options.height) / 1e6 / std::max(stats.seconds, 1e-9);
+	return stats;
+}
+
+}
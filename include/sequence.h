@@ -0,0 +1,70 @@
+#pragma once
+
+#include "huge_pages.h"
+
+#include <cstdint>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <functional>
+
+namespace fib {
+
+// terms F(0) .. F(last)
+inline std::vector<int> make_fibonacci_sequence(std::size_t last)
+{
+	std::vector<int> fibonacci(last + 1, 0);
+	if (last == 0)
+		return fibonacci;
+
+	std::fill(fibonacci.begin() + 1, fibonacci.end(), 1);
+	std::adjacent_difference(fibonacci.begin() + 1, fibonacci.end() - 1, fibonacci.begin() + 2, std::plus<int>{});
+	return fibonacci;
+}
+
+/*
+ *  big integer terms past the int range, every term has the same number of
+ *  32 bit limbs, least significant first, so term i starts at i * limbs
+ */
+struct limb_sequence
+{
+	std::size_t limbs = 0;
+	std::vector<std::uint32_t, huge_page_allocator<std::uint32_t>> data{};
+
+	std::size_t size() const { return limbs != 0 ? data.size() / limbs : 0; }
+	std::uint32_t const* term(std::size_t i) const { return data.data() + i * limbs; }
+	std::uint32_t* term(std::size_t i) { return data.data() + i * limbs; }
+};
+
+// terms F(0) .. F(last) as big integers
+inline limb_sequence make_fibonacci_limbs(std::size_t last)
+{
+	// F(n) < phi^n, log2(phi) < 0.6943
+	limb_sequence fibonacci{};
+	fibonacci.limbs = static_cast<std::size_t>(last * 0.6943) / 32 + 1;
+	// zeroed by the pool threads, so the pages are spread over their nodes
+	fibonacci.data.resize((last + 1) * fibonacci.limbs);
+	first_touch(fibonacci.data.data(), fibonacci.data.size(), 0u);
+	if (last == 0)
+		return fibonacci;
+
+	fibonacci.term(1)[0] = 1u;
+	for (std::size_t i = 2; i <= last; ++i)
+	{
+		auto const* a = fibonacci.term(i - 2);
+		auto const* b = fibonacci.term(i - 1);
+		auto* c = fibonacci.term(i);
+
+		std::uint64_t carry = 0;
+		for (std::size_t limb = 0; limb < fibonacci.limbs; ++limb)
+		{
+			carry += std::uint64_t(a[limb]) + b[limb];
+			c[limb] = static_cast<std::uint32_t>(carry);
+			carry >>= 32;
+		}
+	}
+
+	return fibonacci;
+}
+
+}
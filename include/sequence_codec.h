@@ -0,0 +1,232 @@
+#pragma once
+
+#include "thread_pool.h"
+#include "cancellation.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+namespace fib {
+namespace codec {
+
+/*
+ *  block residual coding of 32 bit limb terms. Every block starts with its
+ *  first two terms stored raw, the following terms are predicted as the sum
+ *  of the two before them (wrapping, like int overflow does) and only the
+ *  per limb difference to the prediction is stored. For a sequence that
+ *  follows the recurrence every residual is zero, and zeros are stored as
+ *  run lengths, so a whole block shrinks to its two checkpoint terms and a
+ *  couple of bytes. Terms that break the recurrence cost a varint each.
+ *
+ *  residual stream of a block, total = (terms - 2) * limbs values:
+ *    repeat { varint zero_run; stop when total is reached; varint zigzag(residual) }
+ *
+ *  Blocks decode independently of each other, which is where the
+ *  parallelism is: the recurrence inside a block is one serial chain.
+ */
+
+inline std::uint32_t zigzag(std::uint32_t v) { return (v << 1) ^ static_cast<std::uint32_t>(static_cast<std::int32_t>(v) >> 31); }
+inline std::uint32_t unzigzag(std::uint32_t v) { return (v >> 1) ^ (0u - (v & 1u)); }
+
+inline void put_varint(std::vector<unsigned char>& out, std::uint64_t v)
+{
+	for (; v >= 0x80; v >>= 7)
+		out.push_back(static_cast<unsigned char>(v | 0x80));
+	out.push_back(static_cast<unsigned char>(v));
+}
+
+// nullptr on a truncated or overlong varint
+inline unsigned char const* get_varint(unsigned char const* first, unsigned char const* last, std::uint64_t& v)
+{
+	v = 0;
+	for (int shift = 0; first != last && shift < 64; shift += 7)
+	{
+		auto const byte = *first++;
+		v |= std::uint64_t(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0)
+			return first;
+	}
+	return nullptr;
+}
+
+// c = a + b over limbs, the carry out of the top limb is dropped
+inline void add_limbs(std::uint32_t const* a, std::uint32_t const* b, std::uint32_t* c, std::size_t limbs)
+{
+	std::uint64_t carry = 0;
+	for (std::size_t limb = 0; limb < limbs; ++limb)
+	{
+		carry += std::uint64_t(a[limb]) + b[limb];
+		c[limb] = static_cast<std::uint32_t>(carry);
+		carry >>= 32;
+	}
+}
+
+inline void encode_block(std::uint32_t const* terms, std::size_t count, std::size_t limbs, std::vector<unsigned char>& out)
+{
+	auto const checkpoint = std::min<std::size_t>(count, 2) * limbs;
+	auto const* raw = reinterpret_cast<unsigned char const*>(terms);
+	out.insert(out.end(), raw, raw + checkpoint * sizeof(std::uint32_t));
+	if (count <= 2)
+		return;
+
+	std::vector<std::uint32_t> predicted(limbs);
+	std::size_t const total = (count - 2) * limbs;
+	std::size_t position = 0, last_nonzero = 0;
+	for (std::size_t i = 2; i < count; ++i)
+	{
+		add_limbs(terms + (i - 2) * limbs, terms + (i - 1) * limbs, predicted.data(), limbs);
+		for (std::size_t limb = 0; limb < limbs; ++limb, ++position)
+		{
+			auto const residual = terms[i * limbs + limb] - predicted[limb];
+			if (residual == 0)
+				continue;
+
+			put_varint(out, position - last_nonzero);
+			put_varint(out, zigzag(residual));
+			last_nonzero = position + 1;
+		}
+	}
+
+	if (last_nonzero < total)
+		put_varint(out, total - last_nonzero);
+}
+
+// false when the block is corrupt
+inline bool decode_block(unsigned char const* first, unsigned char const* last, std::size_t count, std::size_t limbs, std::uint32_t* terms)
+{
+	auto const checkpoint = std::min<std::size_t>(count, 2) * limbs;
+	if (std::size_t(last - first) < checkpoint * sizeof(std::uint32_t))
+		return false;
+
+	std::memcpy(terms, first, checkpoint * sizeof(std::uint32_t));
+	first += checkpoint * sizeof(std::uint32_t);
+	if (count <= 2)
+		return first == last;
+
+	// position of the next nonzero residual, total once there is none left
+	std::size_t const total = (count - 2) * limbs;
+	std::size_t position = 0;
+	std::uint32_t residual = 0;
+	auto next_residual = [&]()
+	{
+		std::uint64_t run = 0, value = 0;
+		first = get_varint(first, last, run);
+		if (first == nullptr || run > total - position)
+			return false;
+
+		position += static_cast<std::size_t>(run);
+		if (position == total)
+			return true;
+
+		first = get_varint(first, last, value);
+		if (first == nullptr || value > 0xffffffffull)
+			return false;
+
+		residual = unzigzag(static_cast<std::uint32_t>(value));
+		return true;
+	};
+
+	if (!next_residual())
+		return false;
+
+	if (limbs == 1)
+	{
+		// int terms, plain adds between the residuals
+		for (std::size_t i = 2; i < count;)
+		{
+			for (auto const stop = std::min(count, position + 2); i < stop; ++i)
+				terms[i] = terms[i - 2] + terms[i - 1];
+
+			if (i == position + 2 && i < count)
+			{
+				terms[i] = terms[i - 2] + terms[i - 1] + residual;
+				++i;
+				if (++position < total && !next_residual())
+					return false;
+			}
+		}
+		return first == last;
+	}
+
+	for (std::size_t i = 2; i < count; ++i)
+	{
+		add_limbs(terms + (i - 2) * limbs, terms + (i - 1) * limbs, terms + i * limbs, limbs);
+
+		// the limbs of term i are residual positions [(i - 2) * limbs, (i - 1) * limbs)
+		while (position < (i - 1) * limbs)
+		{
+			terms[2 * limbs + position] += residual;
+			if (++position < total && !next_residual())
+				return false;
+		}
+	}
+
+	return first == last;
+}
+
+/*
+ *  encodes count terms in blocks of block_terms, offsets gets one entry per
+ *  block plus the end, relative to the start of data
+ */
+inline void encode_blocks(std::uint32_t const* terms, std::size_t count, std::size_t limbs, std::size_t block_terms, unsigned int threads,
+	std::vector<std::uint64_t>& offsets, std::vector<unsigned char>& data)
+{
+	block_terms = std::max<std::size_t>(block_terms, 2);
+	auto const blocks = (count + block_terms - 1) / block_terms;
+	std::vector<std::vector<unsigned char>> encoded(blocks);
+
+	std::atomic<std::size_t> next_block{ 0 };
+	auto work = [&]()
+	{
+		for (auto block = next_block++; block < blocks; block = next_block++)
+		{
+			auto const first = block * block_terms;
+			encode_block(terms + first * limbs, std::min(block_terms, count - first), limbs, encoded[block]);
+		}
+	};
+
+	threads = std::min<std::size_t>(threads != 0 ? threads : std::max(std::thread::hardware_concurrency(), 1u), std::max<std::size_t>(blocks, 1));
+	run_parallel(static_cast<unsigned int>(threads), work);
+
+	offsets.assign(1, 0);
+	data.clear();
+	for (auto const& block : encoded)
+	{
+		data.insert(data.end(), block.cbegin(), block.cend());
+		offsets.push_back(data.size());
+	}
+}
+
+/*
+ *  false when any block is corrupt or on cancel, every block decodes on its
+ *  own. offsets[blocks] is the size of data, no block reaches past it.
+ */
+inline bool decode_blocks(unsigned char const* data, std::uint64_t const* offsets, std::size_t count, std::size_t limbs, std::size_t block_terms, unsigned int threads,
+	std::uint32_t* terms, cancellation_token const& cancel = {})
+{
+	auto const blocks = (count + block_terms - 1) / block_terms;
+	std::atomic<std::size_t> next_block{ 0 };
+	std::atomic<bool> failed{ false };
+	auto work = [&]()
+	{
+		for (auto block = next_block++; block < blocks && !failed && !cancel.cancelled(); block = next_block++)
+		{
+			auto const first = block * block_terms;
+			if (offsets[block] > offsets[block + 1] || offsets[block + 1] > offsets[blocks] ||
+				!decode_block(data + offsets[block], data + offsets[block + 1], std::min(block_terms, count - first), limbs, terms + first * limbs))
+				failed = true;
+		}
+	};
+
+	threads = std::min<std::size_t>(threads != 0 ? threads : std::max(std::thread::hardware_concurrency(), 1u), std::max<std::size_t>(blocks, 1));
+	run_parallel(static_cast<unsigned int>(threads), work);
+
+	return !failed && !cancel.cancelled();
+}
+
+}
+}
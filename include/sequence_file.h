@@ -0,0 +1,486 @@
+#pragma once
+
+#include "sequence.h"
+#include "sequence_codec.h"
+#include "file_writer.h"
+#include "cancellation.h"
+
+#include <stdio.h>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <initializer_list>
+#include <algorithm>
+#include <limits>
+#include <new>
+#include <stdexcept>
+
+namespace fib {
+
+/*
+ *  .bin sequence container, version 2:
+ *
+ *    sequence_header   64 bytes, native byte order, byte_order tells readers which
+ *
+ *  raw encoding, the only one of version 1:
+ *    terms             count * limbs elements of width bytes each, nothing after them
+ *
+ *  block_residual encoding, 32 bit elements only, see sequence_codec.h:
+ *    block_terms       uint64, terms per block, 2 .. sequence_max_block_terms
+ *    blocks            uint64, ceil(count / block_terms)
+ *    offsets           uint64 x (blocks + 1), where each block starts in the block data, the last is its size
+ *    block data        encoded blocks back to back, nothing after them
+ *
+ *  files without the magic are legacy raw dumps of int and are read as such.
+ */
+enum class element_type : std::uint8_t
+{
+	signed_integer = 1,
+	unsigned_integer = 2,
+	limbs = 3,          // unsigned big integer, least significant limb first
+};
+
+enum class sequence_encoding : std::uint32_t
+{
+	raw = 0,
+	block_residual = 1,
+};
+
+struct sequence_header
+{
+	char magic[8];              // "FIBSEQ\r\n", the line break catches text mode transfers
+	std::uint32_t byte_order;   // 0x01020304 as written
+	std::uint16_t version;      // 0 for legacy raw dumps, never written
+	element_type type;
+	std::uint8_t width;         // bytes per element, per limb for big integers
+	std::uint32_t limbs;        // elements per term, 1 unless big integers
+	sequence_encoding encoding; // raw in version 1, where this was reserved
+	std::uint64_t count;        // terms
+	std::uint64_t first_index;  // the first term is F(first_index)
+	std::int64_t seed[2];       // the two terms the recurrence started from
+	std::uint64_t checksum;     // sequence_checksum of the terms
+};
+static_assert(sizeof(sequence_header) == 64, "the header is part of the file format");
+
+constexpr char sequence_magic[8] = { 'F', 'I', 'B', 'S', 'E', 'Q', '\r', '\n' };
+constexpr std::uint32_t sequence_byte_order = 0x01020304u;
+constexpr std::uint16_t sequence_version = 2;
+constexpr std::size_t sequence_block_terms = 4096;
+constexpr std::size_t sequence_max_block_terms = std::size_t(1) << 20;
+constexpr std::uint64_t sequence_checksum_seed = 14695981039346656037ull;
+
+/*
+ *  fnv-1a over 64 bit words with a final fold, trailing bytes one at a time.
+ *  Can be fed in pieces as long as every piece but the last is a multiple of 8 bytes.
+ */
+inline std::uint64_t sequence_checksum(void const* data, std::size_t bytes, std::uint64_t hash = sequence_checksum_seed)
+{
+	constexpr std::uint64_t prime = 1099511628211ull;
+	auto const* p = static_cast<unsigned char const*>(data);
+
+	for (; bytes >= 8; p += 8, bytes -= 8)
+	{
+		std::uint64_t word;
+		std::memcpy(&word, p, 8);
+		hash = (hash ^ word) * prime;
+		hash ^= hash >> 32;
+	}
+	for (; bytes > 0; ++p, --bytes)
+		hash = (hash ^ *p) * prime;
+
+	return hash;
+}
+
+inline std::uint64_t sequence_data_offset(sequence_header const& header)
+{
+	return header.version == 0 ? 0 : sizeof(sequence_header);
+}
+
+inline std::uint64_t sequence_term_bytes(sequence_header const& header)
+{
+	return std::uint64_t(header.width) * header.limbs;
+}
+
+namespace detail {
+
+inline sequence_header make_sequence_header(element_type type, std::uint8_t width, std::uint32_t limbs, std::uint64_t count, std::uint64_t first_index, std::int64_t seed0, std::int64_t seed1)
+{
+	sequence_header header{};
+	std::memcpy(header.magic, sequence_magic, sizeof(header.magic));
+	header.byte_order = sequence_byte_order;
+	header.version = sequence_version;
+	header.type = type;
+	header.width = width;
+	header.limbs = limbs;
+	header.count = count;
+	header.first_index = first_index;
+	header.seed[0] = seed0;
+	header.seed[1] = seed1;
+	return header;
+}
+
+// header, then the sections back to back
+inline bool write_sequence_file(std::string_view filename, sequence_header const& header, std::initializer_list<file_section> sections)
+{
+	std::vector<file_section> all{ { &header, sizeof(header) } };
+	all.insert(all.end(), sections);
+	return replace_file(std::string(filename), all);
+}
+
+inline bool write_sequence_data(std::string_view filename, sequence_header header, void const* data, std::size_t bytes)
+{
+	header.checksum = sequence_checksum(data, bytes);
+	return write_sequence_file(filename, header, { { data, bytes } });
+}
+
+inline bool write_block_residual_data(std::string_view filename, sequence_header header, std::uint32_t const* data, std::size_t block_terms, unsigned int threads)
+{
+	header.encoding = sequence_encoding::block_residual;
+	header.checksum = sequence_checksum(data, header.count * sequence_term_bytes(header));
+
+	std::uint64_t layout[2] = { std::clamp<std::uint64_t>(block_terms, 2, sequence_max_block_terms), 0 };
+	std::vector<std::uint64_t> offsets{};
+	std::vector<unsigned char> blocks{};
+	codec::encode_blocks(data, header.count, header.limbs, layout[0], threads, offsets, blocks);
+	layout[1] = offsets.size() - 1;
+
+	return write_sequence_file(filename, header, {
+		{ layout, sizeof(layout) },
+		{ offsets.data(), offsets.size() * sizeof(std::uint64_t) },
+		{ blocks.data(), blocks.size() } });
+}
+
+// stops at the first problem and says what it was, the file size must match the header exactly
+inline bool check_sequence_header(sequence_header const& header, std::uint64_t file_size, std::string_view filename)
+{
+	auto const name = std::string(filename);
+
+	if (header.byte_order != sequence_byte_order)
+	{
+		fprintf(stderr, "'%s' was written with a different byte order\n", name.c_str());
+		return false;
+	}
+	if (header.version > sequence_version)
+	{
+		fprintf(stderr, "'%s' is version %d, only up to %d is known\n", name.c_str(), (int)header.version, (int)sequence_version);
+		return false;
+	}
+	if (header.type != element_type::signed_integer && header.type != element_type::unsigned_integer && header.type != element_type::limbs)
+	{
+		fprintf(stderr, "'%s' has unknown element type %d\n", name.c_str(), (int)header.type);
+		return false;
+	}
+	if (header.width == 0 || header.limbs == 0 || (header.type != element_type::limbs && header.limbs != 1))
+	{
+		fprintf(stderr, "'%s' has invalid element width %d x %d\n", name.c_str(), (int)header.width, (int)header.limbs);
+		return false;
+	}
+
+	if (header.encoding != sequence_encoding::raw && header.encoding != sequence_encoding::block_residual)
+	{
+		fprintf(stderr, "'%s' has unknown encoding %d\n", name.c_str(), (int)header.encoding);
+		return false;
+	}
+
+	auto const term_bytes = sequence_term_bytes(header);
+	auto const payload = file_size - sizeof(sequence_header);
+	if (header.encoding == sequence_encoding::block_residual)
+	{
+		// the block layout is checked when it is read
+		if (header.width != sizeof(std::uint32_t) || payload < 3 * sizeof(std::uint64_t))
+		{
+			fprintf(stderr, "'%s' has an invalid block layout\n", name.c_str());
+			return false;
+		}
+	}
+	else if (header.count > payload / term_bytes || header.count * term_bytes != payload)
+	{
+		fprintf(stderr, "'%s' holds %llu bytes of terms, the header announces %llu terms of %llu bytes\n", name.c_str(),
+			(unsigned long long)payload, (unsigned long long)header.count, (unsigned long long)term_bytes);
+		return false;
+	}
+
+	return true;
+}
+
+// the block table of a block_residual payload, read and checked before the terms are allocated
+struct block_layout
+{
+	std::uint64_t block_terms = 0;
+	std::vector<std::uint64_t> offsets{};   // blocks + 1
+};
+
+/*
+ *  reads the block table and checks it against the header and the file
+ *  size. Every block holds its first two terms verbatim, so with a bounded
+ *  block_terms the count the header announces is bounded by the payload.
+ */
+inline bool read_block_layout(std::ifstream& ifs, sequence_header const& header, std::string_view filename, block_layout& layout)
+{
+	auto const name = std::string(filename);
+
+	ifs.seekg(0, std::ios::end);
+	auto const payload = static_cast<std::uint64_t>(ifs.tellg()) - sizeof(sequence_header);
+	ifs.seekg(static_cast<std::streamoff>(sizeof(sequence_header)), std::ios::beg);
+
+	std::uint64_t table[2] = { 0, 0 };
+	ifs.read(reinterpret_cast<char*>(table), sizeof(table));
+	auto const block_terms = table[0], blocks = table[1];
+	if (!ifs || block_terms < 2 || block_terms > sequence_max_block_terms || blocks >= payload / sizeof(std::uint64_t) ||
+		blocks != header.count / block_terms + (header.count % block_terms != 0 ? 1 : 0))
+	{
+		fprintf(stderr, "'%s' has an invalid block layout\n", name.c_str());
+		return false;
+	}
+
+	auto& offsets = layout.offsets;
+	offsets.assign(blocks + 1, 0);
+	ifs.read(reinterpret_cast<char*>(offsets.data()), static_cast<std::streamsize>(offsets.size() * sizeof(std::uint64_t)));
+	// every block within the block data, or a block could be decoded from past its end
+	auto const table_bytes = sizeof(table) + (blocks + 1) * sizeof(std::uint64_t);
+	if (!ifs || offsets.front() != 0 || offsets.back() != payload - table_bytes || !std::is_sorted(offsets.cbegin(), offsets.cend()))
+	{
+		fprintf(stderr, "'%s' has an invalid block layout\n", name.c_str());
+		return false;
+	}
+
+	auto const checkpoint_bytes = std::uint64_t(header.limbs) * sizeof(std::uint32_t);
+	for (std::uint64_t block = 0; block < blocks; ++block)
+	{
+		auto const terms = std::min<std::uint64_t>(block_terms, header.count - block * block_terms);
+		if (offsets[block + 1] - offsets[block] < std::min<std::uint64_t>(terms, 2) * checkpoint_bytes)
+		{
+			fprintf(stderr, "'%s' has an invalid block layout\n", name.c_str());
+			return false;
+		}
+	}
+
+	layout.block_terms = block_terms;
+	return true;
+}
+
+// decodes a block_residual payload into data, ifs is where read_block_layout() left it
+inline bool read_block_residual_data(std::ifstream& ifs, sequence_header const& header, block_layout const& layout, std::uint32_t* data, std::string_view filename, cancellation_token const& cancel)
+{
+	auto const name = std::string(filename);
+	auto const& offsets = layout.offsets;
+	auto const block_terms = layout.block_terms;
+
+	std::vector<unsigned char> encoded(static_cast<std::size_t>(offsets.back()));
+	ifs.read(reinterpret_cast<char*>(encoded.data()), static_cast<std::streamsize>(encoded.size()));
+	if (!ifs)
+	{
+		fprintf(stderr, "cannot read '%s'\n", name.c_str());
+		return false;
+	}
+
+	if (!codec::decode_blocks(encoded.data(), offsets.data(), header.count, header.limbs, block_terms, 0, data, cancel))
+	{
+		if (cancel.cancelled())
+			return false;
+
+		fprintf(stderr, "'%s' has corrupt blocks\n", name.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+// whatever has to be checked before the terms are allocated: the block table of a block_residual file
+inline bool prepare_sequence_data(std::ifstream& ifs, sequence_header const& header, std::string_view filename, block_layout& layout)
+{
+	return header.encoding != sequence_encoding::block_residual || read_block_layout(ifs, header, filename, layout);
+}
+
+// runs resize(), which allocates the terms, failing on a count no buffer can hold
+template <class Resize>
+bool allocate_sequence_data(sequence_header const& header, std::string_view filename, Resize&& resize)
+{
+	if (header.count <= std::numeric_limits<std::size_t>::max() / sequence_term_bytes(header))
+	{
+		try
+		{
+			resize();
+			return true;
+		}
+		catch (std::bad_alloc const&)
+		{
+		}
+		catch (std::length_error const&)
+		{
+		}
+	}
+
+	fprintf(stderr, "'%s' announces %llu terms, more than fit in memory\n", std::string(filename).c_str(), (unsigned long long)header.count);
+	return false;
+}
+
+// reads the terms the header describes into data, allocated by the caller, a cancelled read fails quietly
+inline bool read_sequence_data(std::ifstream& ifs, sequence_header const& header, block_layout const& layout, void* data, std::string_view filename, cancellation_token const& cancel)
+{
+	auto const bytes = header.count * sequence_term_bytes(header);
+	if (header.encoding == sequence_encoding::block_residual)
+	{
+		if (!read_block_residual_data(ifs, header, layout, static_cast<std::uint32_t*>(data), filename, cancel))
+			return false;
+	}
+	else
+	{
+		ifs.seekg(static_cast<std::streamoff>(sequence_data_offset(header)), std::ios::beg);
+		ifs.read(static_cast<char*>(data), static_cast<std::streamsize>(bytes));
+		if (!ifs)
+		{
+			fprintf(stderr, "cannot read '%s'\n", std::string(filename).c_str());
+			return false;
+		}
+	}
+
+	if (cancel.cancelled())
+		return false;
+
+	if (header.version != 0 && sequence_checksum(data, bytes) != header.checksum)
+	{
+		fprintf(stderr, "'%s' fails its checksum\n", std::string(filename).c_str());
+		return false;
+	}
+
+	return true;
+}
+
+// header from the first bytes of a file, legacy raw dumps get a synthesized version 0 header
+inline bool parse_sequence_header(void const* first, std::uint64_t file_size, std::string_view filename, sequence_header& header)
+{
+	header = sequence_header{};
+	if (file_size >= sizeof(header))
+	{
+		std::memcpy(&header, first, sizeof(header));
+		if (std::memcmp(header.magic, sequence_magic, sizeof(header.magic)) == 0)
+			return check_sequence_header(header, file_size, filename);
+	}
+
+	// legacy raw dump of int written by the save path
+	header = sequence_header{};
+	header.version = 0;
+	header.byte_order = sequence_byte_order;
+	header.type = element_type::signed_integer;
+	header.width = sizeof(int);
+	header.limbs = 1;
+	header.count = file_size / sizeof(int);
+	header.seed[1] = 1;
+	return true;
+}
+
+inline bool open_sequence(std::string_view filename, std::ifstream& ifs, sequence_header& header)
+{
+	ifs.open(std::string(filename), std::ios::binary | std::ios::ate);
+	if (!ifs.is_open())
+		return false;
+
+	auto const file_size = static_cast<std::uint64_t>(ifs.tellg());
+	ifs.seekg(0, std::ios::beg);
+
+	char first[sizeof(sequence_header)] = { 0, };
+	if (file_size >= sizeof(first))
+		ifs.read(first, sizeof(first));
+	ifs.clear();
+
+	return parse_sequence_header(first, file_size, filename, header);
+}
+}
+
+// header of a .bin file, legacy raw dumps get a synthesized version 0 header
+inline bool read_sequence_header(std::string_view filename, sequence_header& header)
+{
+	std::ifstream ifs{};
+	return detail::open_sequence(filename, ifs, header);
+}
+
+/*
+ *  int terms from a .bin file or a legacy raw dump. The header, and the
+ *  block table of a block coded file, are checked against the file size
+ *  before anything is allocated, the terms are read with one allocation
+ *  and verified by checksum.
+ */
+inline bool read_sequence(std::string_view filename, std::vector<int>& fibonacci, cancellation_token const& cancel = {})
+{
+	std::ifstream ifs{};
+	sequence_header header{};
+	if (!detail::open_sequence(filename, ifs, header))
+		return false;
+
+	if (header.type != element_type::signed_integer || header.width != sizeof(int))
+	{
+		fprintf(stderr, "'%s' does not hold %d byte integers\n", std::string(filename).c_str(), (int)sizeof(int));
+		return false;
+	}
+
+	detail::block_layout layout{};
+	if (!detail::prepare_sequence_data(ifs, header, filename, layout) ||
+		!detail::allocate_sequence_data(header, filename, [&]() { fibonacci.resize(header.count); }))
+		return false;
+
+	return detail::read_sequence_data(ifs, header, layout, fibonacci.data(), filename, cancel);
+}
+
+inline bool read_sequence(std::string_view filename, limb_sequence& fibonacci, cancellation_token const& cancel = {})
+{
+	std::ifstream ifs{};
+	sequence_header header{};
+	if (!detail::open_sequence(filename, ifs, header))
+		return false;
+
+	if (header.type != element_type::limbs || header.width != sizeof(std::uint32_t))
+	{
+		fprintf(stderr, "'%s' does not hold 32 bit limbs\n", std::string(filename).c_str());
+		return false;
+	}
+
+	detail::block_layout layout{};
+	if (!detail::prepare_sequence_data(ifs, header, filename, layout) ||
+		!detail::allocate_sequence_data(header, filename, [&]() { fibonacci.data.resize(header.count * header.limbs); }))
+		return false;
+
+	fibonacci.limbs = header.limbs;
+	return detail::read_sequence_data(ifs, header, layout, fibonacci.data.data(), filename, cancel);
+}
+
+// terms F(first_index) .., seeded with F(first_index) and F(first_index + 1)
+inline bool write_sequence(std::string_view filename, int const* terms, std::size_t count, std::uint64_t first_index = 0, std::int64_t seed0 = 0, std::int64_t seed1 = 1)
+{
+	auto const header = detail::make_sequence_header(element_type::signed_integer, sizeof(int), 1, count, first_index, seed0, seed1);
+	return detail::write_sequence_data(filename, header, terms, count * sizeof(int));
+}
+
+inline bool write_sequence(std::string_view filename, std::vector<int> const& fibonacci, std::uint64_t first_index = 0, std::int64_t seed0 = 0, std::int64_t seed1 = 1)
+{
+	return write_sequence(filename, fibonacci.data(), fibonacci.size(), first_index, seed0, seed1);
+}
+
+inline bool write_sequence(std::string_view filename, limb_sequence const& fibonacci, std::uint64_t first_index = 0, std::int64_t seed0 = 0, std::int64_t seed1 = 1)
+{
+	auto const header = detail::make_sequence_header(element_type::limbs, sizeof(std::uint32_t), static_cast<std::uint32_t>(fibonacci.limbs), fibonacci.size(), first_index, seed0, seed1);
+	return detail::write_sequence_data(filename, header, fibonacci.data.data(), fibonacci.data.size() * sizeof(std::uint32_t));
+}
+
+/*
+ *  block_residual coded, a sequence that follows the recurrence costs its
+ *  two checkpoint terms per block and little else, read back by read_sequence
+ */
+inline bool write_compact_sequence(std::string_view filename, int const* terms, std::size_t count, std::uint64_t first_index = 0, std::int64_t seed0 = 0, std::int64_t seed1 = 1,
+	std::size_t block_terms = sequence_block_terms, unsigned int threads = 0)
+{
+	auto const header = detail::make_sequence_header(element_type::signed_integer, sizeof(int), 1, count, first_index, seed0, seed1);
+	return detail::write_block_residual_data(filename, header, reinterpret_cast<std::uint32_t const*>(terms), block_terms, threads);
+}
+
+inline bool write_compact_sequence(std::string_view filename, limb_sequence const& fibonacci, std::uint64_t first_index = 0, std::int64_t seed0 = 0, std::int64_t seed1 = 1,
+	std::size_t block_terms = sequence_block_terms, unsigned int threads = 0)
+{
+	auto const header = detail::make_sequence_header(element_type::limbs, sizeof(std::uint32_t), static_cast<std::uint32_t>(fibonacci.limbs), fibonacci.size(), first_index, seed0, seed1);
+	return detail::write_block_residual_data(filename, header, fibonacci.data.data(), block_terms, threads);
+}
+
+}
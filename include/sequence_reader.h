@@ -0,0 +1,198 @@
+#pragma once
+
+#include "sequence_file.h"
+
+#include <stdio.h>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+namespace fib {
+
+struct sequence_reader_options
+{
+	std::size_t chunk_bytes = std::size_t(4) << 20;
+	std::size_t buffers = 4;   // at least 2, one is read into while the other is consumed
+};
+
+/*
+ *  reads the int terms of a .bin file in chunks through a fixed pool of
+ *  buffers, a background thread reads ahead while the caller consumes.
+ *  Memory use is buffers * chunk_bytes whatever the file size. fibcli svg
+ *  streams both of its passes through it, fibcli raster only the terms
+ *  into the spiral index, which keeps a point per term. The viewer still
+ *  maps or decodes the whole file, it validates and draws every term.
+ */
+class sequence_reader
+{
+private:
+	std::string filename_{};
+	std::ifstream ifs_{};
+	sequence_header header_{};
+	std::size_t chunk_terms_ = 0;
+	std::vector<std::unique_ptr<int[]>> buffers_{};
+
+public:
+	bool open(std::string_view filename, sequence_reader_options const& options = {})
+	{
+		filename_ = std::string(filename);
+		ifs_ = std::ifstream{};
+		if (!detail::open_sequence(filename, ifs_, header_))
+			return false;
+
+		if (header_.type != element_type::signed_integer || header_.width != sizeof(int))
+		{
+			fprintf(stderr, "'%s' does not hold %d byte integers\n", filename_.c_str(), (int)sizeof(int));
+			return false;
+		}
+
+		if (header_.encoding != sequence_encoding::raw)
+		{
+			fprintf(stderr, "'%s' is block coded, read_sequence decodes it\n", filename_.c_str());
+			return false;
+		}
+
+		// an even number of terms keeps every chunk but the last a multiple of 8 bytes for the checksum
+		chunk_terms_ = std::max<std::size_t>(options.chunk_bytes / sizeof(int) / 2 * 2, 2);
+		buffers_.resize(std::max<std::size_t>(options.buffers, 2));
+		for (auto& buffer : buffers_)
+			buffer.reset(new int[chunk_terms_]);
+
+		return true;
+	}
+
+	sequence_header const& header() const { return header_; }
+	std::size_t size() const { return static_cast<std::size_t>(header_.count); }
+
+	// the most this reader holds in memory
+	std::size_t buffer_bytes() const { return buffers_.size() * chunk_terms_ * sizeof(int); }
+
+	/*
+	 *  calls on_chunk(int const* first, int const* last) for consecutive
+	 *  ranges of terms, in file order, can be called again for another pass.
+	 *  The checksum is computed along the way, a mismatch or read error is
+	 *  only known once all chunks went through and makes this return false.
+	 *  An exception from on_chunk stops the read ahead and is rethrown once
+	 *  the reading thread is joined.
+	 */
+	template <class ChunkFunction>
+	bool for_each_chunk(ChunkFunction&& on_chunk)
+	{
+		if (buffers_.empty())
+			return false;
+
+		std::mutex mutex;
+		std::condition_variable changed;
+		std::vector<std::size_t> free_buffers(buffers_.size());
+		for (std::size_t i = 0; i < free_buffers.size(); ++i)
+			free_buffers[i] = i;
+		std::deque<std::pair<std::size_t, std::size_t>> filled_buffers{};
+		bool done = false;
+		bool failed = false;
+		bool stopped = false;     // the consumer left, nothing more is read
+		auto checksum = sequence_checksum_seed;
+
+		ifs_.clear();
+		ifs_.seekg(static_cast<std::streamoff>(sequence_data_offset(header_)), std::ios::beg);
+
+		std::thread producer{ [&]()
+		{
+			for (auto remaining = header_.count; remaining > 0;)
+			{
+				std::size_t buffer = 0;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					changed.wait(lock, [&]() { return !free_buffers.empty() || stopped; });
+					if (stopped)
+						break;
+					buffer = free_buffers.back();
+					free_buffers.pop_back();
+				}
+
+				auto const terms = static_cast<std::size_t>(std::min<std::uint64_t>(remaining, chunk_terms_));
+				ifs_.read(reinterpret_cast<char*>(buffers_[buffer].get()), static_cast<std::streamsize>(terms * sizeof(int)));
+				if (!ifs_)
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					failed = true;
+					break;
+				}
+
+				checksum = sequence_checksum(buffers_[buffer].get(), terms * sizeof(int), checksum);
+				remaining -= terms;
+
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					filled_buffers.emplace_back(buffer, terms);
+				}
+				changed.notify_all();
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				done = true;
+			}
+			changed.notify_all();
+		}};
+
+		try
+		{
+			while (true)
+			{
+				std::pair<std::size_t, std::size_t> chunk{};
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					changed.wait(lock, [&]() { return !filled_buffers.empty() || done; });
+					if (filled_buffers.empty())
+						break;
+					chunk = filled_buffers.front();
+					filled_buffers.pop_front();
+				}
+
+				auto const* first = buffers_[chunk.first].get();
+				on_chunk(first, first + chunk.second);
+
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					free_buffers.push_back(chunk.first);
+				}
+				changed.notify_all();
+			}
+		}
+		catch (...)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopped = true;
+			}
+			changed.notify_all();
+			producer.join();
+			throw;
+		}
+
+		producer.join();
+
+		if (failed)
+		{
+			fprintf(stderr, "cannot read '%s'\n", filename_.c_str());
+			return false;
+		}
+		if (header_.version != 0 && checksum != header_.checksum)
+		{
+			fprintf(stderr, "'%s' fails its checksum\n", filename_.c_str());
+			return false;
+		}
+
+		return true;
+	}
+};
+
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "sequence.h"
+#include "thread_pool.h"
+#include "cancellation.h"
+
+#include <cstdint>
+#include <chrono>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+namespace fib {
+
+struct validation_stats
+{
+	std::size_t terms = 0;
+	double seconds = 0.;
+	unsigned int threads = 0;
+};
+
+namespace detail {
+
+constexpr std::size_t validation_block_terms = std::size_t(1) << 16;
+
+/*
+ *  true when terms [first, last) of the block follow the recurrence. The
+ *  mismatches are or-ed together without a branch, which the compiler
+ *  turns into vector adds and compares. int terms wrap like
+ *  make_fibonacci_sequence and the block coder do.
+ */
+inline bool block_follows_recurrence(int const* terms, std::size_t first, std::size_t last)
+{
+	auto mismatch_at = [terms](std::size_t i)
+	{
+		return (static_cast<std::uint32_t>(terms[i - 2]) + static_cast<std::uint32_t>(terms[i - 1])) ^ static_cast<std::uint32_t>(terms[i]);
+	};
+
+	// fixed width groups vectorize even where the compiler will not peel a loop for it
+	constexpr std::size_t lanes = 8;
+	std::uint32_t mismatch = 0;
+	auto i = first;
+	for (; i + lanes <= last; i += lanes)
+	{
+		for (std::size_t lane = 0; lane < lanes; ++lane)
+			mismatch |= mismatch_at(i + lane);
+	}
+	for (; i < last; ++i)
+		mismatch |= mismatch_at(i);
+	return mismatch == 0;
+}
+
+// big integers must not carry out of the top limb either
+inline bool block_follows_recurrence(limb_sequence const& fibonacci, std::size_t first, std::size_t last)
+{
+	auto const limbs = fibonacci.limbs;
+	std::uint64_t mismatch = 0;
+	for (auto i = first; i < last; ++i)
+	{
+		auto const* a = fibonacci.term(i - 2);
+		auto const* b = fibonacci.term(i - 1);
+		auto const* c = fibonacci.term(i);
+
+		std::uint64_t carry = 0;
+		for (std::size_t limb = 0; limb < limbs; ++limb)
+		{
+			carry += std::uint64_t(a[limb]) + b[limb];
+			mismatch |= static_cast<std::uint32_t>(carry) ^ c[limb];
+			carry >>= 32;
+		}
+		mismatch |= carry;
+	}
+	return mismatch == 0;
+}
+
+/*
+ *  blocks are checked on several threads, a failed block is rescanned term
+ *  by term for where it breaks. Blocks after the earliest break found so
+ *  far are skipped, as is everything once cancelled.
+ */
+template <class BlockCheck>
+std::size_t find_break(std::size_t count, unsigned int threads, cancellation_token const& cancel, thread_pool& pool, validation_stats& stats, BlockCheck&& check)
+{
+	using clock = std::chrono::steady_clock;
+	auto const start = clock::now();
+
+	auto const blocks = (count + validation_block_terms - 1) / validation_block_terms;
+	stats = validation_stats{};
+	stats.terms = count;
+	stats.threads = static_cast<unsigned int>(std::clamp<std::size_t>(
+		threads != 0 ? threads : std::max(std::thread::hardware_concurrency(), 1u), 1, std::max<std::size_t>(blocks, 1)));
+
+	std::atomic<std::size_t> next_block{ 0 };
+	std::atomic<std::size_t> first_break{ count };
+	auto work = [&]()
+	{
+		for (auto block = next_block++; block < blocks; block = next_block++)
+		{
+			auto const first = std::max<std::size_t>(block * validation_block_terms, 2);
+			auto const last = std::min(block * validation_block_terms + validation_block_terms, count);
+			if (cancel.cancelled() || first >= first_break || first >= last || check(first, last))
+				continue;
+
+			auto at = first;
+			while (at + 1 < last && check(at, at + 1))
+				++at;
+
+			// the earliest break wins whichever thread finds it
+			for (auto known = first_break.load(); at < known && !first_break.compare_exchange_weak(known, at);)
+				;
+		}
+	};
+
+	run_parallel(stats.threads, work, pool);
+
+	stats.seconds = std::chrono::duration<double>(clock::now() - start).count();
+	return first_break;
+}
+
+}
+
+/*
+ *  index of the first term that is not the sum of the two before it, count
+ *  when every term is. threads 0 uses all cores. A cancelled check stops
+ *  early, the result is then count and means nothing. The threads beyond
+ *  the caller come from pool.
+ */
+inline std::size_t find_recurrence_break(int const* terms, std::size_t count, unsigned int threads, validation_stats& stats,
+	cancellation_token const& cancel = {}, thread_pool& pool = default_pool())
+{
+	return detail::find_break(count, threads, cancel, pool, stats, [terms](std::size_t first, std::size_t last)
+	{
+		return detail::block_follows_recurrence(terms, first, last);
+	});
+}
+
+inline std::size_t find_recurrence_break(limb_sequence const& fibonacci, unsigned int threads, validation_stats& stats,
+	cancellation_token const& cancel = {}, thread_pool& pool = default_pool())
+{
+	return detail::find_break(fibonacci.size(), threads, cancel, pool, stats, [&fibonacci](std::size_t first, std::size_t last)
+	{
+		return detail::block_follows_recurrence(fibonacci, first, last);
+	});
+}
+
+}
@@ -0,0 +1,303 @@
+#pragma once
+
+#include "huge_pages.h"
+
+#include <cstdint>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <utility>
+#include <limits>
+
+namespace fib {
+
+/*
+ *  one spiral square as consumed by the renderers, 24 bytes per instance.
+ *  (x, y) is the lower left corner in world coordinates, orientation is the
+ *  corner holding the center of the quarter arc:
+ *  0 lower left, 1 lower right, 2 upper right, 3 upper left
+ */
+struct square
+{
+	float x, y;
+	float width, height;
+	std::uint32_t orientation;
+	std::uint32_t color; // packed RGBA, same layout as ImU32
+};
+
+static_assert(sizeof(square) == 6 * sizeof(float), "square is uploaded as is to the instance buffer");
+
+/*
+ *  consecutive spiral points are opposite corners of a square, the spiral
+ *  turns counter clockwise so the arc center is the corner reached by
+ *  rotating (prev - center) by +90 degrees onto (next - center)
+ */
+template <class Point>
+square make_square(Point const& prev, Point const& next, std::uint32_t color)
+{
+	auto const dx = next.x - prev.x;
+	auto const dy = next.y - prev.y;
+
+	bool left, bottom;
+	if ((dx < 0) != (dy < 0))
+	{
+		// center is (next.x, prev.y)
+		left = dx < 0;
+		bottom = dy > 0;
+	}
+	else
+	{
+		// center is (prev.x, next.y)
+		left = dx > 0;
+		bottom = dy < 0;
+	}
+
+	square s{};
+	s.x = std::min(prev.x, next.x);
+	s.y = std::min(prev.y, next.y);
+	s.width = dx < 0 ? -dx : dx;
+	s.height = dy < 0 ? -dy : dy;
+	s.orientation = left ? (bottom ? 0u : 3u) : (bottom ? 1u : 2u);
+	s.color = color;
+	return s;
+}
+
+/*
+ *  scalar replay of get_fibonacci_points, (x(), y()) is the current spiral
+ *  point and advance() applies the scale/translate/rotate step of one pair of
+ *  consecutive terms. The spiral point is the origin plus the segment (dx, dy).
+ */
+template <class T>
+class spiral_walker
+{
+private:
+	T origin_x_{ 0 }, origin_y_{ 0 };
+	T dx_{ 1 }, dy_{ 0 };
+	std::size_t step_ = 0;
+
+public:
+	T x() const { return origin_x_ + dx_; }
+	T y() const { return origin_y_ + dy_; }
+
+	template <class Integer>
+	void advance(Integer prev, Integer next)
+	{
+		T const k = prev == 0 ? T(1) : T(next) / T(prev);
+		T const d = prev == 0 ? T(0) : T(next) - T(prev);
+
+		// circular_scale_iterator: x, y, x, y axis with -, -, +, + translation
+		T const sign = (step_ % 4) < 2 ? T(-1) : T(1);
+		if (step_ % 2 == 0)
+		{
+			dx_ *= k;
+			origin_x_ += sign * d;
+		}
+		else
+		{
+			dy_ *= k;
+			origin_y_ += sign * d;
+		}
+
+		// rotate the segment by +90 degrees around the new origin
+		T const rotated = -dy_;
+		dy_ = dx_;
+		dx_ = rotated;
+
+		++step_;
+	}
+};
+
+/*
+ *  double precision spiral points with the bounds of every prefix of squares.
+ *  Each square is attached outside the bounds of the squares before it, so
+ *  once the prefix bounds of square k contain the view no later square can
+ *  be visible. Together with the sizes growing along the sequence this
+ *  bounds the squares visible at any zoom level to a handful, whatever the
+ *  length of the spiral.
+ */
+class spiral_index
+{
+public:
+	struct point { double x, y; };
+	struct bounds { double min_x, min_y, max_x, max_y; };
+	using point_vector = std::vector<point, huge_page_allocator<point>>;
+
+private:
+	point_vector points_{};
+	std::vector<bounds, huge_page_allocator<bounds>> prefix_{};
+
+	double size(std::size_t k) const
+	{
+		auto const w = points_[k + 1].x - points_[k].x;
+		auto const h = points_[k + 1].y - points_[k].y;
+		return std::max(w < 0. ? -w : w, h < 0. ? -h : h);
+	}
+
+	void build_prefix()
+	{
+		if (points_.size() < 2)
+			return;
+
+		prefix_.reserve(points_.size() - 1);
+		bounds b{
+			std::min(points_[0].x, points_[1].x), std::min(points_[0].y, points_[1].y),
+			std::max(points_[0].x, points_[1].x), std::max(points_[0].y, points_[1].y) };
+		prefix_.push_back(b);
+		for (std::size_t k = 2; k < points_.size(); ++k)
+		{
+			b.min_x = std::min(b.min_x, points_[k].x);
+			b.min_y = std::min(b.min_y, points_[k].y);
+			b.max_x = std::max(b.max_x, points_[k].x);
+			b.max_y = std::max(b.max_y, points_[k].y);
+			prefix_.push_back(b);
+		}
+	}
+
+public:
+	spiral_index() = default;
+
+	template <class FibonacciRandomAccessIt>
+	spiral_index(FibonacciRandomAccessIt begin, FibonacciRandomAccessIt end)
+	{
+		if (std::distance(begin, end) < 2)
+			return;
+
+		spiral_walker<double> walker{};
+		points_.reserve(std::distance(begin, end) - 1);
+		for (auto it = begin; it + 1 != end; ++it)
+		{
+			points_.push_back(point{ walker.x(), walker.y() });
+			walker.advance(*it, *(it + 1));
+		}
+
+		build_prefix();
+	}
+
+	// points saved from an earlier index, e.g. by the geometry cache
+	explicit spiral_index(point_vector points) : points_(std::move(points))
+	{
+		build_prefix();
+	}
+
+	// number of squares, square k spans points()[k] to points()[k + 1]
+	std::size_t size() const { return prefix_.size(); }
+	point_vector const& points() const { return points_; }
+
+	// of all squares, inverted (min above max) for an index without any
+	bounds total_bounds() const
+	{
+		if (prefix_.empty())
+		{
+			auto const infinity = std::numeric_limits<double>::infinity();
+			return bounds{ infinity, infinity, -infinity, -infinity };
+		}
+		return prefix_.back();
+	}
+
+	/*
+	 *  squares intersecting the view that are at least min_size world units
+	 *  wide or tall, in coordinates relative to (origin_x, origin_y) so that
+	 *  they keep full float precision however deep the zoom
+	 */
+	void visible_squares(
+		double left, double bottom, double right, double top,
+		double min_size,
+		double origin_x, double origin_y,
+		std::uint32_t color,
+		std::vector<square>& out) const
+	{
+		out.clear();
+		if (prefix_.empty())
+			return;
+
+		// first prefix whose bounds contain the view, later squares are all outside of it
+		auto const contains = std::partition_point(prefix_.cbegin(), prefix_.cend(), [&](bounds const& b)
+		{
+			return !(b.min_x <= left && b.min_y <= bottom && b.max_x >= right && b.max_y >= top);
+		});
+		auto const last = contains == prefix_.cend() ? prefix_.size() - 1 : std::size_t(contains - prefix_.cbegin());
+
+		// first square that is not below min_size
+		std::size_t lo = 0, hi = last + 1;
+		while (lo < hi)
+		{
+			auto const mid = lo + (hi - lo) / 2;
+			if (size(mid) < min_size) lo = mid + 1; else hi = mid;
+		}
+
+		for (auto k = lo; k <= last; ++k)
+		{
+			auto const& p = points_[k];
+			auto const& q = points_[k + 1];
+			if (std::max(p.x, q.x) < left || std::min(p.x, q.x) > right ||
+				std::max(p.y, q.y) < bottom || std::min(p.y, q.y) > top)
+				continue;
+
+			struct relative { float x, y; };
+			out.push_back(make_square(
+				relative{ static_cast<float>(p.x - origin_x), static_cast<float>(p.y - origin_y) },
+				relative{ static_cast<float>(q.x - origin_x), static_cast<float>(q.y - origin_y) },
+				color));
+		}
+	}
+};
+
+/*
+ *  builds the same index as spiral_index(begin, end) from terms that
+ *  arrive in pieces, every piece starting with the last term of the one
+ *  before, so the pairs across the seams are walked once
+ */
+class spiral_index_builder
+{
+private:
+	spiral_walker<double> walker_{};
+	spiral_index::point_vector points_{};
+
+public:
+	void reserve(std::size_t terms) { points_.reserve(terms > 0 ? terms - 1 : 0); }
+
+	template <class FibonacciRandomAccessIt>
+	void append(FibonacciRandomAccessIt begin, FibonacciRandomAccessIt end)
+	{
+		for (auto it = begin; std::distance(it, end) >= 2; ++it)
+		{
+			points_.push_back(spiral_index::point{ walker_.x(), walker_.y() });
+			walker_.advance(*it, *(it + 1));
+		}
+	}
+
+	spiral_index build() { return spiral_index(std::move(points_)); }
+};
+
+/*
+ *  world space result of one spiral generation, cached by the ui and
+ *  reprojected through the camera every frame
+ */
+struct spiral_geometry
+{
+	// outermost first, in the order the worker streams them
+	std::vector<square> squares{};
+	float min_x = 0.f, min_y = 0.f;
+	float max_x = 0.f, max_y = 0.f;
+
+	// exact geometry for deep zoom
+	spiral_index index{};
+};
+
+template <class PointRandomAccessIt>
+auto get_fibonacci_squares(PointRandomAccessIt begin, PointRandomAccessIt end, std::uint32_t color) -> std::vector<square>
+{
+	std::vector<square> squares{};
+	if (std::distance(begin, end) < 2)
+		return squares;
+
+	squares.reserve(std::distance(begin, end) - 1);
+	for (auto it = begin + 1; it != end; ++it)
+	{
+		squares.push_back(make_square(*(it - 1), *it, color));
+	}
+
+	return squares;
+}
+
+}
@@ -0,0 +1,743 @@
+#pragma once
+
+#include "spiral.h"
+#include "sequence.h"
+#include "rasterizer.h"
+#include "thread_pool.h"
+#include "job_scheduler.h"
+#include "cancellation.h"
+
+#include <stdio.h>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <list>
+#include <map>
+#include <string>
+#include <tuple>
+#include <atomic>
+#include <algorithm>
+
+#if !defined(_WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#if !defined(_WIN32) && !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+#if !defined(_WIN32) && !defined(MSG_MORE)
+#define MSG_MORE 0
+#endif
+
+namespace fib {
+
+/*
+ *  spiral service protocol, fixed size frames in native byte order over a
+ *  local stream socket:
+ *
+ *    service_request    32 bytes, client to server
+ *    service_response   32 bytes, server to client, followed by bytes of payload
+ *
+ *  A client may send any number of requests without waiting, responses
+ *  come back in the order they finish, the tag of a request is echoed in
+ *  its response to match them up. Payloads are
+ *
+ *    sequence   int32 terms F(first) .. F(second)
+ *    points     spiral_index::point of the spiral of those terms
+ *    raster     width x height 8 bit grayscale pixels, rows top to bottom
+ *
+ *  All three are built from int terms, so second is at most
+ *  service_max_second, F(46) is the last term an int holds. A request
+ *  past it is answered too_large.
+ */
+enum class service_kind : std::uint16_t
+{
+	sequence = 1,
+	points = 2,
+	raster = 3,
+};
+
+enum class service_status : std::uint16_t
+{
+	ok = 0,
+	bad_request = 1,   // unknown kind, bad magic or version, or first past second
+	too_large = 2,     // over the server's term or pixel limit
+	failed = 3,        // the job threw or was cancelled, e.g. at shutdown
+};
+
+struct service_request
+{
+	std::uint32_t magic;      // service_magic
+	std::uint16_t version;    // service_version
+	service_kind kind;
+	std::uint32_t first;      // first term of the spiral
+	std::uint32_t second;     // last term of the sequence
+	std::uint32_t width;      // raster only
+	std::uint32_t height;     // raster only
+	std::uint64_t tag;        // echoed in the response
+};
+static_assert(sizeof(service_request) == 32, "the request is part of the protocol");
+
+struct service_response
+{
+	std::uint32_t magic;
+	std::uint16_t version;
+	service_kind kind;
+	service_status status;
+	std::uint16_t cached;     // 1 when the payload came from the result cache
+	std::uint32_t count;      // terms, points or pixels
+	std::uint64_t tag;
+	std::uint64_t bytes;      // of payload following the response
+};
+static_assert(sizeof(service_response) == 32, "the response is part of the protocol");
+
+constexpr std::uint32_t service_magic = 0x53424946; // "FIBS"
+constexpr std::uint16_t service_version = 1;
+constexpr std::uint32_t service_max_second = 46;
+
+// a response payload, shared between the cache and every client it is sent to
+using service_payload = std::shared_ptr<std::vector<unsigned char> const>;
+
+struct service_result
+{
+	service_status status = service_status::failed;
+	std::uint32_t count = 0;
+	service_payload payload{};
+};
+
+// the parameters a payload depends on, the tag is not one of them
+using service_key = std::tuple<service_kind, std::uint32_t, std::uint32_t, std::uint32_t, std::uint32_t>;
+
+inline service_key make_service_key(service_request const& request)
+{
+	auto const raster = request.kind == service_kind::raster;
+	return service_key{ request.kind, request.first, request.second, raster ? request.width : 0u, raster ? request.height : 0u };
+}
+
+struct service_limits
+{
+	std::uint32_t max_second = service_max_second; // lower to serve less, never above service_max_second
+	std::uint64_t max_pixels = 8192 * 8192;
+};
+
+inline service_status check_service_request(service_request const& request, service_limits const& limits)
+{
+	if (request.magic != service_magic || request.version != service_version || request.first > request.second ||
+		(request.kind != service_kind::sequence && request.kind != service_kind::points && request.kind != service_kind::raster) ||
+		(request.kind == service_kind::raster && (request.width == 0 || request.height == 0)))
+		return service_status::bad_request;
+
+	if (request.second > std::min(limits.max_second, service_max_second) ||
+		(request.kind == service_kind::raster && std::uint64_t(request.width) * request.height > limits.max_pixels))
+		return service_status::too_large;
+
+	return service_status::ok;
+}
+
+/*
+ *  computes the payload of a checked request. A raster is drawn on one
+ *  thread, the server runs several requests at once instead.
+ */
+inline service_result compute_service_request(service_request const& request, cancellation_token const& cancel)
+{
+	auto const fibonacci = make_fibonacci_sequence(request.second);
+	auto const begin = fibonacci.cbegin() + request.first;
+
+	service_result result{};
+	auto payload = std::make_shared<std::vector<unsigned char>>();
+	if (request.kind == service_kind::sequence)
+	{
+		result.count = static_cast<std::uint32_t>(fibonacci.cend() - begin);
+		payload->resize(result.count * sizeof(int));
+		std::memcpy(payload->data(), &*begin, payload->size());
+	}
+	else if (request.kind == service_kind::points)
+	{
+		auto const index = spiral_index(begin, fibonacci.cend());
+		result.count = static_cast<std::uint32_t>(index.points().size());
+		payload->resize(result.count * sizeof(spiral_index::point));
+		if (result.count > 0)
+			std::memcpy(payload->data(), index.points().data(), payload->size());
+	}
+	else
+	{
+		raster_options options{};
+		options.width = static_cast<int>(request.width);
+		options.height = static_cast<int>(request.height);
+		options.threads = 1;
+		options.cancel = cancel;
+
+		raster_image image{};
+		if (rasterize(spiral_index(begin, fibonacci.cend()), options, image).cancelled)
+			return result;
+
+		result.count = request.width * request.height;
+		payload->assign(image.pixels.get(), image.pixels.get() + result.count);
+	}
+
+	result.status = service_status::ok;
+	result.payload = std::move(payload);
+	return result;
+}
+
+/*
+ *  least recently used payloads up to a byte budget. One budget covers
+ *  every client, so a result one client asked for is a hit for the next.
+ *  Not synchronized, the server only touches it from its event loop.
+ */
+class service_cache
+{
+private:
+	using entry = std::pair<service_key, service_result>;
+
+	std::list<entry> entries_{}; // most recently used first
+	std::map<service_key, std::list<entry>::iterator> index_{};
+	std::size_t budget_;
+	std::size_t bytes_ = 0;
+
+	static std::size_t size(service_result const& result) { return result.payload ? result.payload->size() : 0; }
+
+public:
+	explicit service_cache(std::size_t budget) : budget_(budget)
+	{
+	}
+
+	std::size_t bytes() const { return bytes_; }
+	std::size_t size() const { return entries_.size(); }
+
+	service_result const* find(service_key const& key)
+	{
+		auto const found = index_.find(key);
+		if (found == index_.end())
+			return nullptr;
+
+		entries_.splice(entries_.begin(), entries_, found->second);
+		return &found->second->second;
+	}
+
+	// a payload over the whole budget is not kept
+	void insert(service_key const& key, service_result const& result)
+	{
+		if (size(result) > budget_ || index_.count(key) != 0)
+			return;
+
+		entries_.emplace_front(key, result);
+		index_[key] = entries_.begin();
+		bytes_ += size(result);
+
+		while (bytes_ > budget_)
+		{
+			bytes_ -= size(entries_.back().second);
+			index_.erase(entries_.back().first);
+			entries_.pop_back();
+		}
+	}
+};
+
+struct spiral_server_options
+{
+	std::size_t max_running = 0;            // requests computed at once, 0 for the pool size
+	std::size_t cache_bytes = 256u << 20;
+	std::size_t client_output_bytes = 64u << 20; // queued for one client, past it its requests are not read until it catches up
+	service_limits limits{};
+};
+
+struct spiral_server_stats
+{
+	std::uint64_t connections = 0;
+	std::uint64_t requests = 0;
+	std::uint64_t rejected = 0;       // bad_request or too_large
+	std::uint64_t cache_hits = 0;
+	std::uint64_t batched = 0;        // answered by a job another request already started
+	std::uint64_t jobs = 0;
+	std::uint64_t failed = 0;
+	std::uint64_t bytes_sent = 0;
+	std::size_t cache_bytes = 0;
+	std::size_t cache_entries = 0;
+};
+
+#if !defined(_WIN32)
+
+/*
+ *  headless spiral service on a unix domain socket. One thread runs a
+ *  poll() loop over the listening socket, the clients and a wake pipe,
+ *  every socket is non-blocking. The requests read in one pass of the
+ *  loop are answered from the cache where possible, the rest are grouped
+ *  by key: the first request of a key starts a job on the pool, the ones
+ *  after it, from any client and until the job finishes, wait for that
+ *  same job. A finished job writes to the wake pipe, the loop then
+ *  caches its payload and queues it to every waiting client. A client
+ *  with more than client_output_bytes of answers queued is not read until
+ *  it has taken enough of them, so one that only sends cannot grow the
+ *  server without bound.
+ */
+class spiral_server
+{
+public:
+	using scheduler = job_scheduler<service_key, service_result>;
+
+private:
+	struct outgoing
+	{
+		service_response header{};
+		service_payload payload{};
+		std::size_t sent = 0;     // of header and payload
+	};
+
+	struct client
+	{
+		int fd = -1;
+		std::vector<unsigned char> input{};
+		std::deque<outgoing> output{};
+		std::size_t output_bytes = 0; // queued and not yet sent
+		bool closing = false;     // sent a malformed frame, closed once the output is flushed, never read again
+
+		// a client that does not read its answers stops being read too
+		bool reading(std::size_t limit) const { return !closing && output_bytes < limit; }
+	};
+
+	struct waiter
+	{
+		std::uint64_t client = 0;
+		std::uint64_t tag = 0;
+	};
+
+	struct in_flight
+	{
+		scheduler::ticket ticket{};
+		service_kind kind{};
+		std::vector<waiter> waiters{};
+	};
+
+	spiral_server_options options_;
+	thread_pool& pool_;
+	int listener_ = -1;
+	int wake_[2] = { -1, -1 };
+	std::string path_{};
+
+	std::map<std::uint64_t, client> clients_{};
+	std::uint64_t next_client_ = 1;
+	std::map<service_key, in_flight> in_flight_{};
+	service_cache cache_;
+	spiral_server_stats stats_{};
+
+	// destroyed first, its jobs write to the wake pipe
+	std::unique_ptr<scheduler> jobs_{};
+
+	static bool set_non_blocking(int fd) { return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0; }
+
+	void respond(std::uint64_t id, std::uint64_t tag, service_kind kind, service_result const& result, bool cached)
+	{
+		auto const found = clients_.find(id);
+		if (found == clients_.end())
+			return;
+
+		outgoing out{};
+		out.header.magic = service_magic;
+		out.header.version = service_version;
+		out.header.kind = kind;
+		out.header.status = result.status;
+		out.header.cached = cached ? 1 : 0;
+		out.header.count = result.count;
+		out.header.tag = tag;
+		out.header.bytes = result.payload ? result.payload->size() : 0;
+		out.payload = result.payload;
+		found->second.output_bytes += sizeof(service_response) + out.header.bytes;
+		found->second.output.push_back(std::move(out));
+	}
+
+	void accept_clients()
+	{
+		while (true)
+		{
+			int fd = ::accept(listener_, nullptr, nullptr);
+			if (fd < 0)
+				return;
+
+			set_non_blocking(fd);
+			clients_[next_client_++].fd = fd;
+			++stats_.connections;
+		}
+	}
+
+	// false once the client hung up, stops early once the client is closing or its output is full
+	bool read_requests(std::uint64_t id, client& c, std::map<service_key, std::pair<service_kind, std::vector<waiter>>>& batch)
+	{
+		unsigned char buffer[64 * 1024];
+		while (c.reading(options_.client_output_bytes))
+		{
+			auto const received = ::recv(c.fd, buffer, sizeof(buffer), 0);
+			if (received == 0)
+				return false;
+			if (received < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				return errno == EAGAIN || errno == EWOULDBLOCK;
+			}
+			c.input.insert(c.input.end(), buffer, buffer + received);
+
+			std::size_t used = 0;
+			for (; !c.closing && c.input.size() - used >= sizeof(service_request); used += sizeof(service_request))
+			{
+				service_request request{};
+				std::memcpy(&request, c.input.data() + used, sizeof(request));
+				++stats_.requests;
+
+				auto const status = check_service_request(request, options_.limits);
+				if (status != service_status::ok)
+				{
+					++stats_.rejected;
+					service_result rejected{};
+					rejected.status = status;
+					respond(id, request.tag, request.kind, rejected, false);
+					// past a bad magic the framing cannot be trusted
+					c.closing = request.magic != service_magic;
+					continue;
+				}
+
+				auto& entry = batch[make_service_key(request)];
+				entry.first = request.kind;
+				entry.second.push_back(waiter{ id, request.tag });
+			}
+			c.input.erase(c.input.begin(), c.input.begin() + used);
+		}
+
+		// whatever follows a bad frame is never parsed
+		if (c.closing)
+			c.input.clear();
+		return true;
+	}
+
+	void dispatch(std::map<service_key, std::pair<service_kind, std::vector<waiter>>>& batch)
+	{
+		for (auto& [key, entry] : batch)
+		{
+			auto& [kind, waiters] = entry;
+			if (auto const* cached = cache_.find(key))
+			{
+				stats_.cache_hits += waiters.size();
+				for (auto const& w : waiters)
+					respond(w.client, w.tag, kind, *cached, true);
+				continue;
+			}
+
+			auto found = in_flight_.find(key);
+			if (found == in_flight_.end())
+			{
+				found = in_flight_.emplace(key, in_flight{ jobs_->submit(key), kind }).first;
+				++stats_.jobs;
+				stats_.batched += waiters.size() - 1;
+			}
+			else
+			{
+				stats_.batched += waiters.size();
+			}
+			found->second.waiters.insert(found->second.waiters.end(), waiters.begin(), waiters.end());
+		}
+	}
+
+	void collect_finished()
+	{
+		for (auto it = in_flight_.begin(); it != in_flight_.end();)
+		{
+			if (!it->second.ticket.ready())
+			{
+				++it;
+				continue;
+			}
+
+			service_result result{};
+			try
+			{
+				auto outcome = it->second.ticket.outcome.get();
+				if (outcome.status == job_status::done)
+					result = std::move(outcome.result);
+			}
+			catch (std::exception const& e)
+			{
+				fprintf(stderr, "spiral request failed: %s\n", e.what());
+			}
+
+			if (result.status == service_status::ok)
+				cache_.insert(it->first, result);
+			else
+				++stats_.failed;
+
+			for (auto const& w : it->second.waiters)
+				respond(w.client, w.tag, it->second.kind, result, false);
+			it = in_flight_.erase(it);
+		}
+	}
+
+	// false once the client is gone or done
+	bool write_responses(client& c)
+	{
+		while (!c.output.empty())
+		{
+			auto& out = c.output.front();
+			auto const payload_bytes = out.payload ? out.payload->size() : 0;
+
+			ssize_t written = 0;
+			if (out.sent < sizeof(service_response))
+			{
+				auto const* header = reinterpret_cast<unsigned char const*>(&out.header);
+				written = ::send(c.fd, header + out.sent, sizeof(service_response) - out.sent, MSG_NOSIGNAL | (payload_bytes > 0 ? MSG_MORE : 0));
+			}
+			else if (payload_bytes > 0)
+			{
+				auto const offset = out.sent - sizeof(service_response);
+				written = ::send(c.fd, out.payload->data() + offset, payload_bytes - offset, MSG_NOSIGNAL);
+			}
+
+			if (written < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				return errno == EAGAIN || errno == EWOULDBLOCK;
+			}
+
+			out.sent += static_cast<std::size_t>(written);
+			c.output_bytes -= static_cast<std::size_t>(written);
+			stats_.bytes_sent += static_cast<std::uint64_t>(written);
+			if (out.sent == sizeof(service_response) + payload_bytes)
+				c.output.pop_front();
+		}
+		return !c.closing;
+	}
+
+	void close_client(std::map<std::uint64_t, client>::iterator it)
+	{
+		::close(it->second.fd);
+		clients_.erase(it);
+	}
+
+public:
+	explicit spiral_server(spiral_server_options const& options = {}, thread_pool& pool = default_pool())
+		: options_(options), pool_(pool), cache_(options.cache_bytes)
+	{
+	}
+
+	spiral_server(spiral_server const&) = delete;
+	spiral_server& operator=(spiral_server const&) = delete;
+
+	~spiral_server()
+	{
+		jobs_.reset();
+		for (auto& [id, c] : clients_)
+			::close(c.fd);
+		for (int fd : { listener_, wake_[0], wake_[1] })
+		{
+			if (fd >= 0)
+				::close(fd);
+		}
+		if (listener_ >= 0)
+			::unlink(path_.c_str());
+	}
+
+	// a socket file left behind by a server that is gone is replaced
+	bool listen(std::string const& path)
+	{
+		sockaddr_un address{};
+		if (path.empty() || path.size() >= sizeof(address.sun_path))
+		{
+			fprintf(stderr, "invalid socket path '%s'\n", path.c_str());
+			return false;
+		}
+		address.sun_family = AF_UNIX;
+		std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+		listener_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listener_ < 0 || ::pipe(wake_) != 0)
+		{
+			fprintf(stderr, "cannot create the server socket: %s\n", strerror(errno));
+			return false;
+		}
+
+		::unlink(path.c_str());
+		if (::bind(listener_, reinterpret_cast<sockaddr const*>(&address), sizeof(address)) != 0 || ::listen(listener_, SOMAXCONN) != 0)
+		{
+			fprintf(stderr, "cannot listen on '%s': %s\n", path.c_str(), strerror(errno));
+			::close(listener_);
+			listener_ = -1;
+			return false;
+		}
+		path_ = path;
+
+		set_non_blocking(listener_);
+		set_non_blocking(wake_[0]);
+		set_non_blocking(wake_[1]);
+
+		job_scheduler_options jobs{};
+		jobs.max_running = options_.max_running != 0 ? options_.max_running : pool_.size();
+		jobs.coalesce = false;
+		jobs.finished = [fd = wake_[1]]() { char const byte = 0; (void)!::write(fd, &byte, 1); };
+		jobs_ = std::make_unique<scheduler>([](service_key const& key, job_context const& context)
+		{
+			service_request request{};
+			std::tie(request.kind, request.first, request.second, request.width, request.height) = key;
+			return compute_service_request(request, context.cancel);
+		}, jobs, pool_);
+		return true;
+	}
+
+	// serves until stop is set, which is looked at least every poll_ms
+	void run(std::atomic<bool> const& stop, int poll_ms = 200)
+	{
+		std::vector<pollfd> fds{};
+		std::vector<std::uint64_t> ids{};
+		std::map<service_key, std::pair<service_kind, std::vector<waiter>>> batch{};
+
+		while (!stop.load(std::memory_order_relaxed))
+		{
+			fds.clear();
+			ids.clear();
+			fds.push_back(pollfd{ listener_, POLLIN, 0 });
+			fds.push_back(pollfd{ wake_[0], POLLIN, 0 });
+			for (auto const& [id, c] : clients_)
+			{
+				auto const events = (c.reading(options_.client_output_bytes) ? POLLIN : 0) | (c.output.empty() ? 0 : POLLOUT);
+				fds.push_back(pollfd{ c.fd, short(events), 0 });
+				ids.push_back(id);
+			}
+
+			if (::poll(fds.data(), fds.size(), poll_ms) < 0 && errno != EINTR)
+			{
+				fprintf(stderr, "poll failed: %s\n", strerror(errno));
+				return;
+			}
+
+			if (fds[0].revents & POLLIN)
+				accept_clients();
+
+			if (fds[1].revents & POLLIN)
+			{
+				char drain[256];
+				while (::read(wake_[0], drain, sizeof(drain)) > 0)
+					;
+			}
+
+			batch.clear();
+			for (std::size_t k = 2; k < fds.size(); ++k)
+			{
+				auto const it = clients_.find(ids[k - 2]);
+				// a client that is not read only notices a hang up when its next answer fails to go out
+				auto const polled = (fds[k].events & POLLIN) ? (POLLIN | POLLHUP | POLLERR) : 0;
+				if ((fds[k].revents & polled) && !read_requests(it->first, it->second, batch))
+					close_client(it);
+			}
+
+			dispatch(batch);
+			collect_finished();
+
+			// answers from the cache, and jobs finished since the poll, go out without waiting for POLLOUT
+			for (auto it = clients_.begin(); it != clients_.end();)
+			{
+				auto const next = std::next(it);
+				if (!it->second.output.empty() && !write_responses(it->second))
+					close_client(it);
+				else if (it->second.closing && it->second.output.empty())
+					close_client(it);
+				it = next;
+			}
+		}
+	}
+
+	spiral_server_stats stats() const
+	{
+		auto stats = stats_;
+		stats.cache_bytes = cache_.bytes();
+		stats.cache_entries = cache_.size();
+		return stats;
+	}
+};
+
+/*
+ *  blocking client. send() and receive() may be interleaved freely, e.g.
+ *  to keep several requests in flight on one connection.
+ */
+class service_client
+{
+private:
+	int fd_ = -1;
+
+	bool transfer(void* data, std::size_t size, bool sending)
+	{
+		auto* bytes = static_cast<unsigned char*>(data);
+		while (size > 0)
+		{
+			auto const done = sending ? ::send(fd_, bytes, size, MSG_NOSIGNAL) : ::recv(fd_, bytes, size, 0);
+			if (done < 0 && errno == EINTR)
+				continue;
+			if (done <= 0)
+				return false;
+			bytes += done;
+			size -= static_cast<std::size_t>(done);
+		}
+		return true;
+	}
+
+public:
+	service_client() = default;
+	service_client(service_client const&) = delete;
+	service_client& operator=(service_client const&) = delete;
+	~service_client() { close(); }
+
+	bool connect(std::string const& path)
+	{
+		close();
+
+		sockaddr_un address{};
+		if (path.size() >= sizeof(address.sun_path))
+			return false;
+		address.sun_family = AF_UNIX;
+		std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+		fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd_ >= 0 && ::connect(fd_, reinterpret_cast<sockaddr const*>(&address), sizeof(address)) == 0)
+			return true;
+
+		close();
+		return false;
+	}
+
+	void close()
+	{
+		if (fd_ >= 0)
+			::close(fd_);
+		fd_ = -1;
+	}
+
+	// magic and version are filled in
+	bool send(service_request request)
+	{
+		request.magic = service_magic;
+		request.version = service_version;
+		return transfer(&request, sizeof(request), true);
+	}
+
+	bool receive(service_response& response, std::vector<unsigned char>& payload)
+	{
+		if (!transfer(&response, sizeof(response), false) || response.magic != service_magic)
+			return false;
+
+		payload.resize(static_cast<std::size_t>(response.bytes));
+		return payload.empty() || transfer(payload.data(), payload.size(), false);
+	}
+
+	bool call(service_request const& request, service_response& response, std::vector<unsigned char>& payload)
+	{
+		return send(request) && receive(response, payload);
+	}
+};
+
+#endif
+
+}
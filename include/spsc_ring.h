@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <vector>
+#include <utility>
+
+namespace fib {
+
+// what the producer and the consumer indices are padded to, so they never share a line
+constexpr std::size_t cache_line_size = 64;
+
+/*
+ *  bounded lock-free ring for exactly one producer thread and one consumer
+ *  thread. The producer owns tail, the consumer owns head, each on its own
+ *  cache line together with the copy of the other index it last saw, so
+ *  the shared index is only read again when the ring looks full or empty.
+ *  Neither side ever waits: try_push() and try_pop() fail instead. The
+ *  class is aligned to a cache line, so whatever follows it in memory
+ *  does not share the producer's line either.
+ */
+template <class T>
+class spsc_ring
+{
+private:
+	std::vector<T> slots_;
+	std::size_t mask_;
+
+	// consumer side
+	alignas(cache_line_size) std::atomic<std::size_t> head_{ 0 };
+	std::size_t tail_seen_ = 0;
+
+	// producer side
+	alignas(cache_line_size) std::atomic<std::size_t> tail_{ 0 };
+	std::size_t head_seen_ = 0;
+
+	static std::size_t round_up(std::size_t capacity)
+	{
+		std::size_t size = 2;
+		while (size < capacity)
+			size *= 2;
+		return size;
+	}
+
+public:
+	// capacity is rounded up to a power of two
+	explicit spsc_ring(std::size_t capacity) : slots_(round_up(capacity)), mask_(slots_.size() - 1)
+	{
+	}
+
+	spsc_ring(spsc_ring const&) = delete;
+	spsc_ring& operator=(spsc_ring const&) = delete;
+
+	std::size_t capacity() const { return slots_.size(); }
+
+	// producer: false when full, value is then left alone
+	bool try_push(T&& value)
+	{
+		auto const tail = tail_.load(std::memory_order_relaxed);
+		if (tail - head_seen_ == slots_.size())
+		{
+			head_seen_ = head_.load(std::memory_order_acquire);
+			if (tail - head_seen_ == slots_.size())
+				return false;
+		}
+
+		slots_[tail & mask_] = std::move(value);
+		tail_.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// consumer: false when empty
+	bool try_pop(T& value)
+	{
+		auto const head = head_.load(std::memory_order_relaxed);
+		if (head == tail_seen_)
+		{
+			tail_seen_ = tail_.load(std::memory_order_acquire);
+			if (head == tail_seen_)
+				return false;
+		}
+
+		value = std::move(slots_[head & mask_]);
+		head_.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	// consumer: the oldest item without taking it, null when empty, valid until the next try_pop()
+	T* front()
+	{
+		auto const head = head_.load(std::memory_order_relaxed);
+		if (head == tail_seen_)
+		{
+			tail_seen_ = tail_.load(std::memory_order_acquire);
+			if (head == tail_seen_)
+				return nullptr;
+		}
+		return &slots_[head & mask_];
+	}
+
+	// either side, a snapshot that may already be stale
+	std::size_t size() const { return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire); }
+};
+
+}
@@ -0,0 +1,342 @@
+#pragma once
+
+#include "imgui.h"
+#include "imgui_impl_opengl3.h"
+
+#include "matrix.h"
+#include "spiral.h"
+
+#include <stdio.h>
+#include <cmath>
+#include <cstddef>
+#include <array>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#if defined(IMGUI_IMPL_OPENGL_LOADER_GL3W)
+#include <GL/gl3w.h>
+#elif defined(IMGUI_IMPL_OPENGL_LOADER_GLEW)
+#include <GL/glew.h>
+#elif defined(IMGUI_IMPL_OPENGL_LOADER_GLAD)
+#include <glad/glad.h>
+#else
+#include IMGUI_IMPL_OPENGL_LOADER_CUSTOM
+#endif
+
+namespace fib {
+
+/*
+ *  GL 3.3 instanced renderer for spiral squares. A single unit square outline
+ *  with its quarter arc is instanced once per fib::square, so the per square
+ *  vertex data is the 24 byte instance itself instead of the polyline ImGui
+ *  builds for every AddRect.
+ *
+ *  Drawing happens from inside the ImGui draw list through a draw callback,
+ *  which keeps the spiral ordered with the rest of the ui.
+ */
+class instanced_square_renderer
+{
+private:
+	static constexpr int arc_segments = 16;
+
+	GLuint program_ = 0;
+	GLuint vao_ = 0;
+	GLuint mesh_vbo_ = 0;
+	GLuint instance_vbo_ = 0;
+	GLint world_to_screen_location_ = -1;
+	GLint display_location_ = -1;
+	GLsizei mesh_vertex_count_ = 0;
+
+	std::size_t instance_count_ = 0;
+	std::size_t instance_capacity_ = 0;
+
+	// squares waiting for upload, staged_offset_ of them are already on the GPU
+	std::vector<square> staged_{};
+	std::size_t staged_offset_ = 0;
+	bool replace_ = false;
+	std::size_t upload_budget_ = std::numeric_limits<std::size_t>::max();
+
+	// screen = world * scale + translate, (scale_x, scale_y, translate_x, translate_y)
+	std::array<float, 4> world_to_screen_{ 1.f, -1.f, 0.f, 0.f };
+
+	void bind_instance_attributes();
+	void reserve(std::size_t capacity);
+	void upload();
+	void draw(ImDrawData const* draw_data);
+	static void draw_callback(ImDrawList const* parent_list, ImDrawCmd const* cmd);
+
+public:
+	instanced_square_renderer() = default;
+	instanced_square_renderer(instanced_square_renderer const&) = delete;
+	instanced_square_renderer& operator=(instanced_square_renderer const&) = delete;
+
+	// GL thread only
+	bool init();
+	void shutdown();
+	bool initialized() const { return program_ != 0; }
+
+	/*
+	 *  stage() replaces the instances, append() adds to them. Uploads happen
+	 *  on the next draws, at most upload_budget instances per frame, so a big
+	 *  spiral refines over a few frames instead of stalling one.
+	 *  The GL thread must not be inside ImGui_ImplOpenGL3_RenderDrawData while staging.
+	 */
+	void stage(std::vector<square> squares) { staged_ = std::move(squares); staged_offset_ = 0; replace_ = true; }
+	void append(std::vector<square> const& squares);
+	void clear() { stage({}); }
+	void upload_budget(std::size_t instances_per_frame) { upload_budget_ = std::max<std::size_t>(instances_per_frame, 1); }
+	void world_to_screen(float sx, float sy, float tx, float ty) { world_to_screen_ = { sx, sy, tx, ty }; }
+
+	// instances on the GPU or waiting for upload
+	std::size_t instance_count() const { return (replace_ ? 0 : instance_count_) + staged_.size() - staged_offset_; }
+	bool uploading() const { return replace_ || staged_offset_ < staged_.size(); }
+
+	// queue the instanced draw at the current position of the draw list
+	void add_to(ImDrawList* draw_list);
+};
+
+inline bool instanced_square_renderer::init()
+{
+	const GLchar* vertex_shader =
+		"#version 330 core\n"
+		"layout (location = 0) in vec2 Unit;\n"
+		"layout (location = 1) in vec2 Origin;\n"
+		"layout (location = 2) in vec2 Size;\n"
+		"layout (location = 3) in uint Orientation;\n"
+		"layout (location = 4) in vec4 Color;\n"
+		"uniform vec4 WorldToScreen;\n"
+		"uniform vec4 Display;\n"
+		"out vec4 Frag_Color;\n"
+		"void main()\n"
+		"{\n"
+		"    vec2 c = Unit - 0.5;\n"
+		"    vec2 r = Orientation == 1u ? vec2(-c.y, c.x) : Orientation == 2u ? -c : Orientation == 3u ? vec2(c.y, -c.x) : c;\n"
+		"    vec2 screen = (Origin + (r + 0.5) * Size) * WorldToScreen.xy + WorldToScreen.zw;\n"
+		"    vec2 ndc = (screen - Display.xy) / Display.zw * 2.0 - 1.0;\n"
+		"    Frag_Color = Color;\n"
+		"    gl_Position = vec4(ndc.x, -ndc.y, 0, 1);\n"
+		"}\n";
+
+	const GLchar* fragment_shader =
+		"#version 330 core\n"
+		"in vec4 Frag_Color;\n"
+		"layout (location = 0) out vec4 Out_Color;\n"
+		"void main()\n"
+		"{\n"
+		"    Out_Color = Frag_Color;\n"
+		"}\n";
+
+	auto compile = [](GLenum type, const GLchar* source, const char* desc) -> GLuint
+	{
+		GLuint handle = glCreateShader(type);
+		glShaderSource(handle, 1, &source, NULL);
+		glCompileShader(handle);
+
+		GLint status = 0;
+		glGetShaderiv(handle, GL_COMPILE_STATUS, &status);
+		if ((GLboolean)status == GL_FALSE)
+		{
+			char log[1024] = { 0, };
+			glGetShaderInfoLog(handle, sizeof(log), NULL, log);
+			fprintf(stderr, "ERROR: instanced_square_renderer: failed to compile %s!\n%s\n", desc, log);
+			glDeleteShader(handle);
+			return 0;
+		}
+		return handle;
+	};
+
+	GLuint vs = compile(GL_VERTEX_SHADER, vertex_shader, "vertex shader");
+	GLuint fs = compile(GL_FRAGMENT_SHADER, fragment_shader, "fragment shader");
+	if (vs == 0 || fs == 0)
+	{
+		glDeleteShader(vs);
+		glDeleteShader(fs);
+		return false;
+	}
+
+	program_ = glCreateProgram();
+	glAttachShader(program_, vs);
+	glAttachShader(program_, fs);
+	glLinkProgram(program_);
+	glDetachShader(program_, vs);
+	glDetachShader(program_, fs);
+	glDeleteShader(vs);
+	glDeleteShader(fs);
+
+	GLint status = 0;
+	glGetProgramiv(program_, GL_LINK_STATUS, &status);
+	if ((GLboolean)status == GL_FALSE)
+	{
+		char log[1024] = { 0, };
+		glGetProgramInfoLog(program_, sizeof(log), NULL, log);
+		fprintf(stderr, "ERROR: instanced_square_renderer: failed to link program!\n%s\n", log);
+		glDeleteProgram(program_);
+		program_ = 0;
+		return false;
+	}
+
+	world_to_screen_location_ = glGetUniformLocation(program_, "WorldToScreen");
+	display_location_ = glGetUniformLocation(program_, "Display");
+
+	// unit square outline followed by the quarter arc centered on corner 0, as line pairs
+	std::vector<float> mesh{
+		0.f, 0.f, 1.f, 0.f,
+		1.f, 0.f, 1.f, 1.f,
+		1.f, 1.f, 0.f, 1.f,
+		0.f, 1.f, 0.f, 0.f
+	};
+	for (int i = 0; i < arc_segments; ++i)
+	{
+		auto a0 = float(i) / arc_segments * pi / 2.f;
+		auto a1 = float(i + 1) / arc_segments * pi / 2.f;
+		mesh.insert(mesh.end(), { std::cos(a0), std::sin(a0), std::cos(a1), std::sin(a1) });
+	}
+	mesh_vertex_count_ = static_cast<GLsizei>(mesh.size() / 2);
+
+	GLint last_vertex_array, last_array_buffer;
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &last_vertex_array);
+	glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &last_array_buffer);
+
+	glGenVertexArrays(1, &vao_);
+	glGenBuffers(1, &mesh_vbo_);
+	glGenBuffers(1, &instance_vbo_);
+
+	glBindVertexArray(vao_);
+
+	glBindBuffer(GL_ARRAY_BUFFER, mesh_vbo_);
+	glBufferData(GL_ARRAY_BUFFER, mesh.size() * sizeof(float), mesh.data(), GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (GLvoid*)0);
+
+	bind_instance_attributes();
+
+	glBindVertexArray(last_vertex_array);
+	glBindBuffer(GL_ARRAY_BUFFER, last_array_buffer);
+
+	return true;
+}
+
+// expects vao_ bound
+inline void instanced_square_renderer::bind_instance_attributes()
+{
+	glBindBuffer(GL_ARRAY_BUFFER, instance_vbo_);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(square), (GLvoid*)offsetof(square, x));
+	glVertexAttribDivisor(1, 1);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(square), (GLvoid*)offsetof(square, width));
+	glVertexAttribDivisor(2, 1);
+	glEnableVertexAttribArray(3);
+	glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, sizeof(square), (GLvoid*)offsetof(square, orientation));
+	glVertexAttribDivisor(3, 1);
+	glEnableVertexAttribArray(4);
+	glVertexAttribPointer(4, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(square), (GLvoid*)offsetof(square, color));
+	glVertexAttribDivisor(4, 1);
+}
+
+inline void instanced_square_renderer::shutdown()
+{
+	if (instance_vbo_) { glDeleteBuffers(1, &instance_vbo_); instance_vbo_ = 0; }
+	if (mesh_vbo_) { glDeleteBuffers(1, &mesh_vbo_); mesh_vbo_ = 0; }
+	if (vao_) { glDeleteVertexArrays(1, &vao_); vao_ = 0; }
+	if (program_) { glDeleteProgram(program_); program_ = 0; }
+	instance_count_ = 0;
+	instance_capacity_ = 0;
+}
+
+inline void instanced_square_renderer::append(std::vector<square> const& squares)
+{
+	if (staged_offset_ == staged_.size())
+	{
+		staged_.clear();
+		staged_offset_ = 0;
+	}
+	staged_.insert(staged_.end(), squares.cbegin(), squares.cend());
+}
+
+// grows the instance buffer keeping the uploaded instances, expects vao_ bound
+inline void instanced_square_renderer::reserve(std::size_t capacity)
+{
+	if (capacity <= instance_capacity_)
+		return;
+
+	GLuint buffer = 0;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, capacity * sizeof(square), NULL, GL_DYNAMIC_DRAW);
+	if (instance_count_ > 0)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, instance_vbo_);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, instance_count_ * sizeof(square));
+	}
+
+	glDeleteBuffers(1, &instance_vbo_);
+	instance_vbo_ = buffer;
+	instance_capacity_ = capacity;
+	bind_instance_attributes();
+}
+
+// expects vao_ bound
+inline void instanced_square_renderer::upload()
+{
+	if (replace_)
+	{
+		instance_count_ = 0;
+		replace_ = false;
+	}
+
+	auto const count = std::min(staged_.size() - staged_offset_, upload_budget_);
+	if (count > 0)
+	{
+		// doubles only when the staged squares do not fit, a replace reuses the buffer it has
+		auto const needed = instance_count_ + staged_.size() - staged_offset_;
+		if (needed > instance_capacity_)
+			reserve(std::max(needed, instance_capacity_ * 2));
+
+		glBindBuffer(GL_ARRAY_BUFFER, instance_vbo_);
+		glBufferSubData(GL_ARRAY_BUFFER, instance_count_ * sizeof(square), count * sizeof(square), staged_.data() + staged_offset_);
+		instance_count_ += count;
+		staged_offset_ += count;
+	}
+
+	if (staged_offset_ == staged_.size())
+	{
+		staged_.clear();
+		staged_offset_ = 0;
+	}
+}
+
+inline void instanced_square_renderer::draw(ImDrawData const* draw_data)
+{
+	if (!initialized() || draw_data == nullptr)
+		return;
+
+	glBindVertexArray(vao_);
+	if (uploading())
+		upload();
+
+	if (instance_count_ == 0)
+		return;
+
+	glUseProgram(program_);
+	glUniform4f(world_to_screen_location_, world_to_screen_[0], world_to_screen_[1], world_to_screen_[2], world_to_screen_[3]);
+	glUniform4f(display_location_, draw_data->DisplayPos.x, draw_data->DisplayPos.y, draw_data->DisplaySize.x, draw_data->DisplaySize.y);
+
+	glDrawArraysInstanced(GL_LINES, 0, mesh_vertex_count_, static_cast<GLsizei>(instance_count_));
+}
+
+inline void instanced_square_renderer::draw_callback(ImDrawList const*, ImDrawCmd const* cmd)
+{
+	auto* self = static_cast<instanced_square_renderer*>(cmd->UserCallbackData);
+	self->draw(ImGui::GetDrawData());
+}
+
+inline void instanced_square_renderer::add_to(ImDrawList* draw_list)
+{
+	draw_list->AddCallback(&instanced_square_renderer::draw_callback, this);
+	// let the backend restore its program, vertex array and blend state
+	draw_list->AddCallback(ImDrawCallback_ResetRenderState, NULL);
+}
+
+}
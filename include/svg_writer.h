@@ -0,0 +1,214 @@
+#pragma once
+
+#include "spiral.h"
+#include "file_writer.h"
+
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <algorithm>
+
+namespace fib {
+
+struct svg_options
+{
+	double width = 1000.;          // document width in user units, the height follows the spiral
+	int precision = 2;             // digits after the decimal point
+	double min_size = 0.;          // squares smaller than this many user units are dropped, ones that round to 0 always are
+	std::size_t max_bytes = 0;     // output size budget, 0 for none, the smallest squares are dropped first
+	double stroke_width = 1.;
+	bool arcs = true;
+	std::size_t buffer_size = std::size_t(1) << 20;
+};
+
+struct svg_stats
+{
+	std::size_t squares_written = 0;
+	std::size_t squares_dropped = 0;
+	std::size_t bytes = 0;
+	double seconds = 0.;
+};
+
+namespace detail {
+
+// fixed notation straight into the output buffer
+inline char* append_number(char* first, double value, int precision)
+{
+	return std::to_chars(first, first + 64, value, std::chars_format::fixed, precision).ptr;
+}
+
+inline char* append_text(char* first, std::string_view text)
+{
+	return std::copy(text.cbegin(), text.cend(), first);
+}
+
+}
+
+/*
+ *  streams the spiral into an svg file: one pass over the terms for the
+ *  bounds, one pass that walks the spiral again and formats every square
+ *  and arc as it is produced. Memory use does not depend on the number of
+ *  terms, nothing but the walker state and the write buffer is kept.
+ *
+ *  for_each_term(visit) calls visit(term) for every term in order and is
+ *  called twice, returning false from it aborts the export.
+ */
+template <class TermSource>
+bool write_svg(std::string const& filename, TermSource&& for_each_term, svg_options const& options, svg_stats& stats)
+{
+	using clock = std::chrono::steady_clock;
+	auto const start = clock::now();
+	stats = svg_stats{};
+
+	// bounds of all spiral points, the point after the last pair is not part of the spiral
+	double min_x = 0., min_y = 0., max_x = 0., max_y = 0.;
+	std::size_t count = 0;
+	{
+		spiral_walker<double> walker{};
+		min_x = max_x = walker.x();
+		min_y = max_y = walker.y();
+		std::size_t terms = 0;
+		long long prev = 0;
+		auto const ok = for_each_term([&](auto term)
+		{
+			if (terms >= 2)
+			{
+				min_x = std::min(min_x, walker.x()); max_x = std::max(max_x, walker.x());
+				min_y = std::min(min_y, walker.y()); max_y = std::max(max_y, walker.y());
+			}
+			if (terms >= 1)
+				walker.advance(prev, static_cast<long long>(term));
+
+			prev = static_cast<long long>(term);
+			++terms;
+		});
+		if (!ok)
+			return false;
+
+		count = terms >= 2 ? terms - 2 : 0;
+	}
+
+	auto const world_width = std::max(max_x - min_x, 1e-300);
+	auto const world_height = std::max(max_y - min_y, 1e-300);
+	auto const scale = options.width / world_width;
+	auto const height = world_height * scale;
+	auto const precision = std::clamp(options.precision, 0, 17);
+	// a side below half the last digit is written as 0, such a square or arc draws nothing
+	auto const degenerate = 0.5 * std::pow(10., -precision);
+
+	// upper bound of one square in bytes, coordinates are within [0, max(width, height)], plus one digit for rounding up
+	auto const integer_digits = std::size_t(std::log10(std::max({ options.width, height, 1. }))) + 2;
+	auto const number_bytes = integer_digits + 1 + std::size_t(precision);
+	constexpr std::string_view rect_open = "<rect x=\"", rect_y = "\" y=\"", rect_width = "\" width=\"", rect_height = "\" height=\"", rect_close = "\"/>\n";
+	constexpr std::string_view path_open = "<path d=\"M", arc = "A", arc_flags = " 0 0 0 ", path_close = "\"/>\n";
+	auto const rect_bytes = rect_open.size() + rect_y.size() + rect_width.size() + rect_height.size() + rect_close.size() + 4 * number_bytes;
+	auto const arc_bytes = path_open.size() + arc.size() + arc_flags.size() + path_close.size() + 4 + 6 * number_bytes;
+	auto const square_bytes = rect_bytes + (options.arcs ? arc_bytes : 0);
+
+	fib::buffered_file_writer out{ options.buffer_size };
+	if (!out.open(filename))
+		return false;
+
+	char header[512];
+	auto* p = header;
+	p = detail::append_text(p, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<svg xmlns=\"http://www.w3.org/2000/svg\" viewBox=\"0 0 ");
+	p = detail::append_number(p, options.width, precision);
+	p = detail::append_text(p, " ");
+	p = detail::append_number(p, height, precision);
+	p = detail::append_text(p, "\">\n<g fill=\"none\" stroke=\"black\" stroke-width=\"");
+	p = detail::append_number(p, options.stroke_width, precision);
+	p = detail::append_text(p, "\">\n");
+	out.write(std::string_view(header, p - header));
+
+	constexpr std::string_view footer = "</g>\n</svg>\n";
+
+	// the sizes grow along the sequence, so the budget keeps a suffix of the squares
+	std::size_t skip = 0;
+	if (options.max_bytes != 0)
+	{
+		auto const fixed = out.size() + footer.size();
+		auto const fitting = options.max_bytes > fixed ? (options.max_bytes - fixed) / square_bytes : 0;
+		skip = count > fitting ? count - fitting : 0;
+	}
+
+	spiral_walker<double> walker{};
+	std::size_t terms = 0;
+	long long prev = 0;
+	auto const ok = for_each_term([&](auto term)
+	{
+		auto const k = terms++;
+		auto const prev_term = prev;
+		prev = static_cast<long long>(term);
+		if (k == 0 || k > count)
+			return;
+
+		auto const px = walker.x(), py = walker.y();
+		walker.advance(prev_term, static_cast<long long>(term));
+		auto const qx = walker.x(), qy = walker.y();
+
+		auto const x0 = (std::min(px, qx) - min_x) * scale;
+		auto const y0 = (max_y - std::max(py, qy)) * scale;
+		auto const w = std::abs(qx - px) * scale;
+		auto const h = std::abs(qy - py) * scale;
+
+		if (k - 1 < skip || std::max(w, h) < options.min_size || std::min(w, h) < degenerate)
+		{
+			++stats.squares_dropped;
+			return;
+		}
+
+		auto* first = out.reserve(square_bytes);
+		auto* q = first;
+		q = detail::append_text(q, rect_open);
+		q = detail::append_number(q, x0, precision);
+		q = detail::append_text(q, rect_y);
+		q = detail::append_number(q, y0, precision);
+		q = detail::append_text(q, rect_width);
+		q = detail::append_number(q, w, precision);
+		q = detail::append_text(q, rect_height);
+		q = detail::append_number(q, h, precision);
+		q = detail::append_text(q, rect_close);
+
+		if (options.arcs)
+		{
+			// counter clockwise on screen, which is the negative angle direction once y points down, sweep flag 0
+			q = detail::append_text(q, path_open);
+			q = detail::append_number(q, (px - min_x) * scale, precision);
+			*q++ = ' ';
+			q = detail::append_number(q, (max_y - py) * scale, precision);
+			q = detail::append_text(q, arc);
+			q = detail::append_number(q, w, precision);
+			*q++ = ' ';
+			q = detail::append_number(q, h, precision);
+			q = detail::append_text(q, arc_flags);
+			q = detail::append_number(q, (qx - min_x) * scale, precision);
+			*q++ = ' ';
+			q = detail::append_number(q, (max_y - qy) * scale, precision);
+			q = detail::append_text(q, path_close);
+		}
+
+		out.commit(q - first);
+		++stats.squares_written;
+	});
+
+	out.write(footer);
+	stats.bytes = out.size();
+	auto const closed = out.close();
+	stats.seconds = std::chrono::duration<double>(clock::now() - start).count();
+	return ok && closed;
+}
+
+template <class FibonacciForwardIt>
+bool write_svg(std::string const& filename, FibonacciForwardIt begin, FibonacciForwardIt end, svg_options const& options, svg_stats& stats)
+{
+	auto for_each_term = [&](auto&& visit)
+	{
+		for (auto it = begin; it != end; ++it)
+			visit(*it);
+		return true;
+	};
+	return write_svg(filename, for_each_term, options, stats);
+}
+
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+#include "sequence.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "cancellation.h"
+
+#include <stdio.h>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+namespace fib {
+
+struct text_read_stats
+{
+	std::size_t bytes = 0;
+	std::size_t terms = 0;
+	double seconds = 0.;
+	unsigned int threads = 0;
+	double megabytes_per_second_per_core = 0.;
+};
+
+inline bool is_text_file(std::string_view filename)
+{
+	return filename.size() > 4 && filename.substr(filename.size() - 4) == ".txt";
+}
+
+namespace detail {
+
+inline bool is_space(char c) { return c == ' ' || c == '\n' || c == '\r' || c == '\t'; }
+
+// a piece of the text, starts and ends on whitespace
+struct text_chunk
+{
+	char const* first;
+	char const* last;
+	char const* error = nullptr;  // first bad token
+	std::vector<int> terms{};
+	std::vector<std::uint32_t> limbs{};        // big integers back to back
+	std::vector<std::uint32_t> term_limbs{};   // limbs of each big integer
+};
+
+inline std::vector<text_chunk> split_text(char const* first, char const* last, std::size_t pieces)
+{
+	std::vector<text_chunk> chunks{};
+	auto const size = std::size_t(last - first);
+	auto begin = first;
+	for (std::size_t i = 1; i <= pieces && begin != last; ++i)
+	{
+		auto end = i == pieces ? last : std::max(begin, first + size / pieces * i);
+		while (end != last && !is_space(*end))
+			++end;
+		chunks.push_back(text_chunk{ begin, end });
+		begin = end;
+	}
+	return chunks;
+}
+
+inline void parse_ints(text_chunk& chunk)
+{
+	chunk.terms.reserve(std::size_t(chunk.last - chunk.first) / 4);
+	for (auto p = chunk.first;;)
+	{
+		while (p != chunk.last && is_space(*p))
+			++p;
+		if (p == chunk.last)
+			return;
+
+		int value = 0;
+		auto const [end, ec] = std::from_chars(p, chunk.last, value);
+		if (ec != std::errc{} || (end != chunk.last && !is_space(*end)))
+		{
+			chunk.error = p;
+			return;
+		}
+
+		chunk.terms.push_back(value);
+		p = end;
+	}
+}
+
+// decimal digits into limbs, nine digits per multiply and add pass
+inline void parse_limbs(char const* first, char const* last, std::vector<std::uint32_t>& limbs)
+{
+	auto const begin = limbs.size();
+	auto multiply_add = [&](std::uint32_t factor, std::uint32_t addend)
+	{
+		std::uint64_t carry = addend;
+		for (auto i = begin; i < limbs.size(); ++i)
+		{
+			carry += std::uint64_t(limbs[i]) * factor;
+			limbs[i] = static_cast<std::uint32_t>(carry);
+			carry >>= 32;
+		}
+		if (carry != 0)
+			limbs.push_back(static_cast<std::uint32_t>(carry));
+	};
+
+	constexpr std::uint32_t powers[] = { 1u, 10u, 100u, 1000u, 10000u, 100000u, 1000000u, 10000000u, 100000000u, 1000000000u };
+	auto const head = std::size_t(last - first) % 9;
+	for (auto p = first; p != last;)
+	{
+		auto const digits = p == first && head != 0 ? head : 9;
+		std::uint32_t group = 0;
+		std::from_chars(p, p + digits, group);
+		multiply_add(powers[digits], group);
+		p += digits;
+	}
+}
+
+inline void parse_big(text_chunk& chunk)
+{
+	for (auto p = chunk.first;;)
+	{
+		while (p != chunk.last && is_space(*p))
+			++p;
+		if (p == chunk.last)
+			return;
+
+		auto end = p;
+		while (end != chunk.last && *end >= '0' && *end <= '9')
+			++end;
+		if (end == p || (end != chunk.last && !is_space(*end)))
+		{
+			chunk.error = p;
+			return;
+		}
+
+		auto const before = chunk.limbs.size();
+		parse_limbs(p, end, chunk.limbs);
+		chunk.term_limbs.push_back(static_cast<std::uint32_t>(chunk.limbs.size() - before));
+		p = end;
+	}
+}
+
+/*
+ *  maps the file, splits it at whitespace into megabyte chunks and runs
+ *  parse(chunk) on each, false after reporting the first bad token. The
+ *  cancel token is checked between chunks, a cancelled parse fails quietly.
+ */
+template <class Parse>
+bool parse_text(std::string_view filename, unsigned int threads, cancellation_token const& cancel, text_read_stats& stats, mapped_file& file, std::vector<text_chunk>& chunks, Parse&& parse)
+{
+	using clock = std::chrono::steady_clock;
+	auto const start = clock::now();
+	stats = text_read_stats{};
+
+	auto const name = std::string(filename);
+	if (!file.open(name))
+		return false;
+	file.advise_sequential();
+
+	auto const* text = reinterpret_cast<char const*>(file.data());
+	stats.bytes = file.size();
+	// picked automatically, below a megabyte per thread the threads cost more than they save
+	stats.threads = threads != 0 ? threads :
+		static_cast<unsigned int>(std::clamp<std::size_t>(stats.bytes >> 20, 1, std::max(std::thread::hardware_concurrency(), 1u)));
+
+	chunks = split_text(text, text + stats.bytes, std::max<std::size_t>(stats.threads, stats.bytes >> 20));
+	std::atomic<std::size_t> next_chunk{ 0 };
+	run_parallel(static_cast<unsigned int>(std::min<std::size_t>(stats.threads, chunks.size())), [&]()
+	{
+		for (auto i = next_chunk++; i < chunks.size() && !cancel.cancelled(); i = next_chunk++)
+			parse(chunks[i]);
+	});
+
+	if (cancel.cancelled())
+		return false;
+
+	for (auto const& chunk : chunks)
+	{
+		if (chunk.error != nullptr)
+		{
+			auto const end = std::find_if(chunk.error, chunk.last, is_space);
+			fprintf(stderr, "'%s' has an invalid term '%.*s' at byte %llu\n", name.c_str(),
+				(int)std::min<std::ptrdiff_t>(end - chunk.error, 32), chunk.error, (unsigned long long)(chunk.error - text));
+			return false;
+		}
+	}
+
+	stats.seconds = std::chrono::duration<double>(clock::now() - start).count();
+	stats.megabytes_per_second_per_core = stats.bytes / 1e6 / std::max(stats.seconds, 1e-9) / stats.threads;
+	return true;
+}
+
+}
+
+/*
+ *  whitespace separated decimal ints, the format write_text produces.
+ *  The file is mapped and parsed with std::from_chars on several threads,
+ *  terms that do not fit an int are an error, read those as big integers.
+ */
+inline bool read_text(std::string_view filename, std::vector<int>& fibonacci, unsigned int threads, text_read_stats& stats,
+	cancellation_token const& cancel = {})
+{
+	mapped_file file{};
+	std::vector<detail::text_chunk> chunks{};
+	if (!detail::parse_text(filename, threads, cancel, stats, file, chunks, detail::parse_ints))
+		return false;
+
+	std::vector<std::size_t> offsets(chunks.size() + 1, 0);
+	for (std::size_t i = 0; i < chunks.size(); ++i)
+		offsets[i + 1] = offsets[i] + chunks[i].terms.size();
+
+	fibonacci.resize(offsets.back());
+	for (std::size_t i = 0; i < chunks.size(); ++i)
+		std::copy(chunks[i].terms.cbegin(), chunks[i].terms.cend(), fibonacci.begin() + offsets[i]);
+
+	stats.terms = fibonacci.size();
+	return true;
+}
+
+// arbitrarily long non negative decimals, every term gets the limbs of the longest one
+inline bool read_text(std::string_view filename, limb_sequence& fibonacci, unsigned int threads, text_read_stats& stats,
+	cancellation_token const& cancel = {})
+{
+	mapped_file file{};
+	std::vector<detail::text_chunk> chunks{};
+	if (!detail::parse_text(filename, threads, cancel, stats, file, chunks, detail::parse_big))
+		return false;
+
+	std::size_t count = 0, limbs = 1;
+	for (auto const& chunk : chunks)
+	{
+		count += chunk.term_limbs.size();
+		for (auto const n : chunk.term_limbs)
+			limbs = std::max<std::size_t>(limbs, n);
+	}
+
+	fibonacci.limbs = limbs;
+	fibonacci.data.assign(count * limbs, 0u);
+	std::size_t term = 0;
+	for (auto const& chunk : chunks)
+	{
+		auto source = chunk.limbs.cbegin();
+		for (auto const n : chunk.term_limbs)
+		{
+			std::copy(source, source + n, fibonacci.term(term++));
+			source += n;
+		}
+	}
+
+	stats.terms = count;
+	return true;
+}
+
+}
@@ -0,0 +1,221 @@
+#pragma once
+
+#include "sequence.h"
+#include "file_writer.h"
+
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+namespace fib {
+
+struct text_options
+{
+	unsigned int threads = 0;                 // 0 picks std::thread::hardware_concurrency()
+	std::size_t chunk_terms = std::size_t(1) << 16;
+	std::size_t buffer_size = std::size_t(4) << 20;
+};
+
+struct text_stats
+{
+	std::size_t bytes = 0;
+	double seconds = 0.;
+	unsigned int threads = 0;
+};
+
+namespace detail {
+
+// decimal of an int term and the separator the old ostream_iterator export wrote
+inline void format_terms(int const* first, int const* last, std::vector<char>& out)
+{
+	constexpr std::size_t term_chars = 12; // sign, 10 digits, separator
+	out.resize(std::size_t(last - first) * term_chars);
+	auto* p = out.data();
+	for (; first != last; ++first)
+	{
+		p = std::to_chars(p, p + term_chars, *first).ptr;
+		*p++ = ' ';
+	}
+	out.resize(std::size_t(p - out.data()));
+}
+
+/*
+ *  decimal of big integer terms, schoolbook division by 10^9 on a scratch
+ *  copy of the limbs, so a term costs quadratic in its limbs
+ */
+inline void format_terms(std::uint32_t const* first, std::size_t count, std::size_t limbs, std::vector<char>& out)
+{
+	constexpr std::uint32_t group = 1000000000u;
+	auto const term_chars = static_cast<std::size_t>(limbs * 32 * 0.30103) + 2;
+	out.resize(count * term_chars);
+	auto* p = out.data();
+
+	std::vector<std::uint32_t> scratch(limbs);
+	std::vector<std::uint32_t> groups{};
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		std::copy(first + i * limbs, first + (i + 1) * limbs, scratch.begin());
+		auto used = limbs;
+		while (used > 0 && scratch[used - 1] == 0)
+			--used;
+
+		groups.clear();
+		while (used > 0)
+		{
+			std::uint64_t remainder = 0;
+			for (auto limb = used; limb-- > 0;)
+			{
+				auto const value = (remainder << 32) | scratch[limb];
+				scratch[limb] = static_cast<std::uint32_t>(value / group);
+				remainder = value % group;
+			}
+			groups.push_back(static_cast<std::uint32_t>(remainder));
+			while (used > 0 && scratch[used - 1] == 0)
+				--used;
+		}
+
+		if (groups.empty())
+		{
+			*p++ = '0';
+		}
+		else
+		{
+			// most significant group as is, the others zero padded to 9 digits
+			p = std::to_chars(p, p + 10, groups.back()).ptr;
+			for (auto g = groups.size() - 1; g-- > 0;)
+			{
+				char digits[10];
+				auto const n = std::to_chars(digits, digits + 10, groups[g]).ptr - digits;
+				std::memset(p, '0', 9 - n);
+				std::memcpy(p + 9 - n, digits, n);
+				p += 9;
+			}
+		}
+		*p++ = ' ';
+	}
+	out.resize(std::size_t(p - out.data()));
+}
+
+/*
+ *  formats chunks on worker threads into a ring of 2 * threads buffers
+ *  and writes them in order on the calling thread. format_chunk(first,
+ *  last, out) fills out with the text of terms [first, last).
+ */
+template <class FormatChunk>
+bool write_text_chunks(std::string const& filename, std::size_t count, text_options const& options, text_stats& stats, FormatChunk&& format_chunk)
+{
+	using clock = std::chrono::steady_clock;
+	auto const start = clock::now();
+	stats = text_stats{};
+
+	buffered_file_writer out{ options.buffer_size };
+	if (!out.open(filename))
+		return false;
+
+	auto const chunk_terms = std::max<std::size_t>(options.chunk_terms, 1);
+	auto const chunks = (count + chunk_terms - 1) / chunk_terms;
+	stats.threads = options.threads != 0 ? options.threads : std::max(std::thread::hardware_concurrency(), 1u);
+	stats.threads = static_cast<unsigned int>(std::max<std::size_t>(std::min<std::size_t>(stats.threads, chunks), 1));
+
+	// slot k % slots holds chunk k, it is free for chunk k once chunk k - slots was written
+	struct slot
+	{
+		std::size_t chunk;
+		bool ready;
+		std::vector<char> text;
+	};
+	std::vector<slot> slots(2 * std::size_t(stats.threads));
+	for (std::size_t s = 0; s < slots.size(); ++s)
+		slots[s] = slot{ s, false, {} };
+
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::atomic<std::size_t> next_chunk{ 0 };
+
+	auto work = [&]()
+	{
+		for (auto k = next_chunk++; k < chunks; k = next_chunk++)
+		{
+			auto& s = slots[k % slots.size()];
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [&]() { return s.chunk == k && !s.ready; });
+			}
+
+			auto const first = k * chunk_terms;
+			format_chunk(first, std::min(first + chunk_terms, count), s.text);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				s.ready = true;
+			}
+			changed.notify_all();
+		}
+	};
+
+	std::vector<std::thread> workers{};
+	for (unsigned int i = 0; i < stats.threads; ++i)
+		workers.emplace_back(work);
+
+	for (std::size_t k = 0; k < chunks; ++k)
+	{
+		auto& s = slots[k % slots.size()];
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [&]() { return s.chunk == k && s.ready; });
+		}
+
+		out.write(std::string_view(s.text.data(), s.text.size()));
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			s.chunk = k + slots.size();
+			s.ready = false;
+		}
+		changed.notify_all();
+	}
+
+	for (auto& worker : workers)
+		worker.join();
+
+	stats.bytes = out.size();
+	auto const ok = out.close();
+	stats.seconds = std::chrono::duration<double>(clock::now() - start).count();
+	return ok;
+}
+
+}
+
+/*
+ *  space separated decimal text, the format the old ostream_iterator
+ *  export wrote, formatted with std::to_chars on several threads
+ */
+inline bool write_text(std::string const& filename, int const* terms, std::size_t count, text_options const& options, text_stats& stats)
+{
+	return detail::write_text_chunks(filename, count, options, stats, [terms](std::size_t first, std::size_t last, std::vector<char>& out)
+	{
+		detail::format_terms(terms + first, terms + last, out);
+	});
+}
+
+inline bool write_text(std::string const& filename, limb_sequence const& fibonacci, text_options const& options, text_stats& stats)
+{
+	// big terms are slow to format, smaller chunks spread them over the threads
+	auto chunked = options;
+	chunked.chunk_terms = std::max<std::size_t>(std::min(options.chunk_terms, (std::size_t(1) << 20) / std::max<std::size_t>(fibonacci.limbs, 1)), 1);
+
+	return detail::write_text_chunks(filename, fibonacci.size(), chunked, stats, [&fibonacci](std::size_t first, std::size_t last, std::vector<char>& out)
+	{
+		detail::format_terms(fibonacci.term(first), last - first, fibonacci.limbs, out);
+	});
+}
+
+}
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <type_traits>
+#include <algorithm>
+
+namespace fib {
+
+struct thread_pool_stats
+{
+	std::uint64_t executed = 0;
+	std::uint64_t stolen = 0;   // taken from another thread's deque
+};
+
+/*
+ *  persistent threads with one task deque each. A pool thread pushes and
+ *  pops at the back of its own deque, so nested work stays hot in its
+ *  cache, and steals from the front of the others when it runs dry. Tasks
+ *  posted from outside the pool are dealt round robin. Idle threads sleep
+ *  on a condition variable.
+ *
+ *  Tasks should not block on other tasks: a thread that has to wait for
+ *  a future runs queued tasks meanwhile through wait(), which is what
+ *  keeps a pool of one thread from deadlocking.
+ */
+class thread_pool
+{
+private:
+	struct task_deque
+	{
+		std::mutex mutex{};
+		std::deque<std::function<void()>> tasks{};
+	};
+
+	std::vector<std::unique_ptr<task_deque>> deques_{};
+	std::vector<std::thread> threads_{};
+	std::mutex sleep_mutex_{};
+	std::condition_variable wake_{};
+	std::atomic<std::size_t> pending_{ 0 };
+	std::atomic<std::size_t> next_deque_{ 0 };
+	std::atomic<std::uint64_t> executed_{ 0 };
+	std::atomic<std::uint64_t> stolen_{ 0 };
+	bool stopping_ = false;
+
+	// the pool and deque of the calling thread, null outside of any pool
+	static thread_pool*& current_pool() { static thread_local thread_pool* pool = nullptr; return pool; }
+	static std::size_t& current_deque() { static thread_local std::size_t index = 0; return index; }
+
+	bool pop(std::size_t index, std::function<void()>& task)
+	{
+		auto& own = *deques_[index];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (own.tasks.empty())
+			return false;
+
+		task = std::move(own.tasks.back());
+		own.tasks.pop_back();
+		return true;
+	}
+
+	bool steal(std::size_t index, std::function<void()>& task)
+	{
+		for (std::size_t k = 1; k <= deques_.size(); ++k)
+		{
+			auto& victim = *deques_[(index + k) % deques_.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (victim.tasks.empty())
+				continue;
+
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			if ((index + k) % deques_.size() != index)
+				++stolen_;
+			return true;
+		}
+		return false;
+	}
+
+	bool try_run(std::size_t index)
+	{
+		std::function<void()> task{};
+		if (!pop(index, task) && !steal(index, task))
+			return false;
+
+		--pending_;
+		task();
+		++executed_;
+		return true;
+	}
+
+	void run(std::size_t index)
+	{
+		current_pool() = this;
+		current_deque() = index;
+
+		while (true)
+		{
+			if (try_run(index))
+				continue;
+
+			std::unique_lock<std::mutex> lock(sleep_mutex_);
+			wake_.wait(lock, [this]() { return stopping_ || pending_ > 0; });
+			if (stopping_ && pending_ == 0)
+				return;
+		}
+	}
+
+public:
+	// 0 threads picks std::thread::hardware_concurrency()
+	explicit thread_pool(unsigned int threads = 0)
+	{
+		threads = threads != 0 ? threads : std::max(std::thread::hardware_concurrency(), 1u);
+		for (unsigned int i = 0; i < threads; ++i)
+			deques_.push_back(std::make_unique<task_deque>());
+		for (unsigned int i = 0; i < threads; ++i)
+			threads_.emplace_back([this, i]() { run(i); });
+	}
+
+	thread_pool(thread_pool const&) = delete;
+	thread_pool& operator=(thread_pool const&) = delete;
+
+	// runs what is still queued, then joins
+	~thread_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex_);
+			stopping_ = true;
+		}
+		wake_.notify_all();
+		for (auto& thread : threads_)
+			thread.join();
+	}
+
+	unsigned int size() const { return static_cast<unsigned int>(threads_.size()); }
+
+	thread_pool_stats stats() const { return thread_pool_stats{ executed_, stolen_ }; }
+
+	void post(std::function<void()> task)
+	{
+		auto const index = current_pool() == this ? current_deque() : next_deque_++ % deques_.size();
+		{
+			auto& target = *deques_[index];
+			std::lock_guard<std::mutex> lock(target.mutex);
+			target.tasks.push_back(std::move(task));
+		}
+
+		++pending_;
+		// a thread about to sleep checks pending_ under this lock, so it cannot miss the notify
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex_);
+		}
+		wake_.notify_one();
+	}
+
+	template <class Function>
+	auto submit(Function&& function) -> std::future<std::invoke_result_t<std::decay_t<Function>>>
+	{
+		using result = std::invoke_result_t<std::decay_t<Function>>;
+		auto task = std::make_shared<std::packaged_task<result()>>(std::forward<Function>(function));
+		auto future = task->get_future();
+		post([task]() { (*task)(); });
+		return future;
+	}
+
+	// runs one queued task on the calling thread, false when there was none
+	bool run_one()
+	{
+		auto const index = current_pool() == this ? current_deque() : next_deque_++ % deques_.size();
+		return try_run(index);
+	}
+
+	// waits for the future, running queued tasks meanwhile
+	template <class T>
+	void wait(std::future<T> const& future)
+	{
+		while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			if (!run_one())
+				future.wait_for(std::chrono::microseconds(100));
+		}
+	}
+};
+
+namespace detail {
+
+inline unsigned int& default_pool_threads() { static unsigned int threads = 0; return threads; }
+
+}
+
+// the size of default_pool(), only has an effect before its first use
+inline void set_default_pool_threads(unsigned int threads) { detail::default_pool_threads() = threads; }
+
+// the pool the generation, geometry and file stages share
+inline thread_pool& default_pool()
+{
+	static thread_pool pool{ detail::default_pool_threads() };
+	return pool;
+}
+
+/*
+ *  runs work() on the calling thread and on up to threads - 1 pool threads
+ *  at once, 0 uses the whole pool. Every copy pulls its items from a shared
+ *  counter until there are none left. Copies the pool only gets to after
+ *  the caller finished do nothing, so this never waits for a busy pool,
+ *  it only waits for the copies that already started.
+ */
+template <class Work>
+void run_parallel(unsigned int threads, Work&& work, thread_pool& pool = default_pool())
+{
+	threads = threads != 0 ? threads : pool.size() + 1;
+
+	struct join_state
+	{
+		std::mutex mutex{};
+		std::condition_variable done{};
+		unsigned int running = 0;
+		bool closed = false;
+	};
+	auto state = std::make_shared<join_state>();
+
+	for (unsigned int i = 1; i < threads; ++i)
+	{
+		pool.post([state, &work]()
+		{
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				if (state->closed)
+					return;
+				++state->running;
+			}
+
+			work();
+
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				--state->running;
+			}
+			state->done.notify_all();
+		});
+	}
+
+	work();
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->closed = true;
+	state->done.wait(lock, [&]() { return state->running == 0; });
+}
+
+}
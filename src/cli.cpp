@@ -0,0 +1,1239 @@
+// headless front end for render servers: no window, no GL context, only the spiral geometry and the CPU rasterizer
+
+#if defined (_MSC_VER)
+#define NOMINMAX
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "spiral.h"
+#include "sequence.h"
+#include "sequence_file.h"
+#include "mapped_file.h"
+#include "sequence_reader.h"
+#include "rasterizer.h"
+#include "svg_writer.h"
+#include "text_writer.h"
+#include "text_reader.h"
+#include "sequence_validation.h"
+#include "thread_pool.h"
+#include "spsc_ring.h"
+#include "spiral_service.h"
+#include "huge_pages.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <chrono>
+#include <fstream>
+#include <thread>
+#include <future>
+#include <functional>
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <random>
+
+#if !defined(_WIN32)
+#include <signal.h>
+#endif
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+static void usage()
+{
+	fprintf(stderr,
+		"usage: fibcli <command> [options]\n"
+		"\n"
+		"spiral options, for all commands:\n"
+		"  --first N        first term of the spiral (default 0)\n"
+		"  --second N       last term of the generated sequence (default 30)\n"
+		"  --input FILE     read the sequence from a .bin or .txt file instead of generating it\n"
+		"  --pages MODE     big buffers on standard, transparent or hugetlb pages (default transparent)\n"
+		"\n"
+		"raster: CPU rasterization to png\n"
+		"  --width W        image width in pixels (default 4096)\n"
+		"  --height H       image height in pixels (default 4096)\n"
+		"  --tile S         tile size in pixels (default 256)\n"
+		"  --threads T      rasterizer threads, 0 for all cores (default 0)\n"
+		"  --thickness P    line width in pixels (default 1)\n"
+		"  --no-arcs        only draw the squares\n"
+		"  --memory B       stream --input through B bytes of read buffers into the spiral index instead of mapping it\n"
+		"  --output FILE    png to write (default fibonacci.png)\n"
+		"\n"
+		"svg: streaming vector export\n"
+		"  --width W        document width in user units (default 1000)\n"
+		"  --precision P    digits after the decimal point (default 2)\n"
+		"  --min-size S     drop squares smaller than S user units (default 0)\n"
+		"  --max-bytes B    output size budget, drops the smallest squares first (default none)\n"
+		"  --no-arcs        only write the squares\n"
+		"  --memory B       stream --input through B bytes of read buffers instead of mapping it\n"
+		"  --output FILE    svg to write (default fibonacci.svg)\n"
+		"\n"
+		"pack: block coded .bin, reports compression ratio and decode speed\n"
+		"  --big            generate big integer terms instead of int\n"
+		"  --block N        terms per block, 2 .. 1048576 (default 4096)\n"
+		"  --threads T      coding threads, 0 for all cores (default 0)\n"
+		"  --output FILE    .bin to write (default fibonacci.bin)\n"
+		"\n"
+		"text: space separated decimal export\n"
+		"  --big            generate big integer terms instead of int\n"
+		"  --threads T      formatting threads, 0 for all cores (default 0)\n"
+		"  --chunk N        terms per formatted chunk (default 65536)\n"
+		"  --output FILE    text to write (default fibonacci.txt)\n"
+		"\n"
+		"validate: checks that every term is the sum of the two before it\n"
+		"  --big            generate or read big integer terms instead of int\n"
+		"  --threads T      checking threads, 0 for all cores (default 0)\n"
+		"\n"
+		"scale: thread pool scaling, each stage on 1, 2, 4 .. pool threads\n"
+		"  --pool N         pool threads, 0 for all cores (default 0)\n"
+		"  --terms N        int terms for the sequence stages (default 20000000)\n"
+		"  --width W        raster size in pixels (default 4096)\n"
+		"\n"
+		"ring: worker to ui chunk handoff, lock-free ring against a mutex queue\n"
+		"  --items N        items to pass (default 1000000)\n"
+		"  --capacity C     items in flight (default 1024)\n"
+		"  --squares S      squares per item, 0 passes timestamps only (default 0)\n"
+		"\n"
+		"serve: spiral service on a unix domain socket, until interrupted\n"
+		"  --socket PATH    socket to listen on (default fibonacci.sock)\n"
+		"  --threads T      pool threads, 0 for all cores (default 0)\n"
+		"  --cache MB       result cache shared by all clients (default 256)\n"
+		"  --backlog MB     answers queued for one client before its requests wait (default 64)\n"
+		"  --max-second N   largest second served, at most 46 (default 46)\n"
+		"\n"
+		"loadgen: closed loop load against a running serve\n"
+		"  --socket PATH    socket to connect to (default fibonacci.sock)\n"
+		"  --clients C      connections, one thread each (default 8)\n"
+		"  --requests R     requests per connection (default 1000)\n"
+		"  --kind K         sequence, points or raster (default points)\n"
+		"  --second N       last term of the requested sequences, at most 46 (default 46)\n"
+		"  --distinct D     requests cycle through D different second values (default 16)\n"
+		"  --width W        raster width and height in pixels (default 256)\n"
+		"\n"
+		"pages: big buffer throughput and TLB misses on each page mode\n"
+		"  --terms N        int terms for the spiral points (default 20000000)\n"
+		"  --big N          big integer terms (default 50000)\n"
+		"  --probes P       random point reads (default 10000000)\n");
+}
+
+struct spiral_arguments
+{
+	unsigned int first = 0;
+	unsigned int second = 30;
+	std::string input{};
+};
+
+// consumes the spiral options at argv[i], returns false for anything else
+static bool parse_spiral_argument(int argc, char** argv, int& i, spiral_arguments& args)
+{
+	std::string_view arg(argv[i]);
+	bool has_value = i + 1 < argc;
+
+	if (arg == "--first" && has_value) args.first = std::strtoul(argv[++i], nullptr, 10);
+	else if (arg == "--second" && has_value) args.second = std::strtoul(argv[++i], nullptr, 10);
+	else if (arg == "--input" && has_value) args.input = argv[++i];
+	else if (arg == "--pages" && has_value)
+	{
+		// every command allocates after parsing, so the mode is set right here
+		fib::page_mode mode{};
+		if (!fib::parse_page_mode(argv[++i], mode))
+			return false;
+		fib::set_page_mode(mode);
+	}
+	else return false;
+
+	return true;
+}
+
+// generated or decoded terms, or the terms of a raw input file read straight from its mapping
+struct sequence_terms
+{
+	std::vector<int> generated{};
+	fib::mapped_sequence mapped{};
+	int const* first = nullptr;
+	int const* last = nullptr;
+
+	int const* begin() const { return first; }
+	int const* end() const { return last; }
+	std::size_t size() const { return static_cast<std::size_t>(last - first); }
+};
+
+static void print_text_read(std::string const& filename, fib::text_read_stats const& stats)
+{
+	printf("parsed '%s': %d terms in %.3f ms, %.1f MB/s per core on %u threads\n",
+		filename.c_str(), (int)stats.terms, stats.seconds * 1e3, stats.megabytes_per_second_per_core, stats.threads);
+}
+
+static bool load_big_sequence(spiral_arguments const& args, fib::limb_sequence& fibonacci)
+{
+	if (args.input.empty())
+	{
+		fibonacci = fib::make_fibonacci_limbs(args.second);
+		return true;
+	}
+
+	if (!fib::is_text_file(args.input))
+		return fib::read_sequence(args.input, fibonacci);
+
+	fib::text_read_stats stats{};
+	if (!fib::read_text(args.input, fibonacci, 0, stats))
+	{
+		fprintf(stderr, "cannot read '%s'\n", args.input.c_str());
+		return false;
+	}
+
+	print_text_read(args.input, stats);
+	return true;
+}
+
+static bool load_sequence(spiral_arguments const& args, sequence_terms& fibonacci)
+{
+	if (args.input.empty())
+	{
+		fibonacci.generated = fib::make_fibonacci_sequence(args.second);
+		fibonacci.first = fibonacci.generated.data();
+		fibonacci.last = fibonacci.generated.data() + fibonacci.generated.size();
+	}
+	else if (fib::is_text_file(args.input))
+	{
+		fib::text_read_stats stats{};
+		if (!fib::read_text(args.input, fibonacci.generated, 0, stats))
+		{
+			fprintf(stderr, "cannot read '%s'\n", args.input.c_str());
+			return false;
+		}
+
+		print_text_read(args.input, stats);
+		fibonacci.first = fibonacci.generated.data();
+		fibonacci.last = fibonacci.generated.data() + fibonacci.generated.size();
+	}
+	else
+	{
+		// raw files are mapped, block coded ones decoded
+		fib::sequence_header header{};
+		auto const raw = fib::read_sequence_header(args.input, header) && header.encoding == fib::sequence_encoding::raw;
+		if (raw ? !fibonacci.mapped.open(args.input) : !fib::read_sequence(args.input, fibonacci.generated))
+		{
+			fprintf(stderr, "cannot open '%s'\n", args.input.c_str());
+			return false;
+		}
+
+		fibonacci.first = raw ? fibonacci.mapped.begin() : fibonacci.generated.data();
+		fibonacci.last = raw ? fibonacci.mapped.end() : fibonacci.generated.data() + fibonacci.generated.size();
+	}
+
+	if (fibonacci.size() < std::size_t(args.first) + 2)
+	{
+		fprintf(stderr, "the sequence has %d terms, at least first + 2 are needed\n", (int)fibonacci.size());
+		return false;
+	}
+
+	return true;
+}
+
+// a .bin to stream through memory bytes of buffers, with the terms the spiral needs
+static bool open_reader(spiral_arguments const& args, std::size_t memory, fib::sequence_reader& reader)
+{
+	fib::sequence_reader_options options{};
+	options.chunk_bytes = memory / options.buffers;
+	if (!reader.open(args.input, options))
+	{
+		fprintf(stderr, "cannot open '%s'\n", args.input.c_str());
+		return false;
+	}
+
+	if (reader.size() < std::size_t(args.first) + 2)
+	{
+		fprintf(stderr, "the sequence has %d terms, at least first + 2 are needed\n", (int)reader.size());
+		return false;
+	}
+
+	return true;
+}
+
+// the index of the terms from first on, one chunk at a time, the pair across each seam on its own
+static bool stream_spiral_index(spiral_arguments const& args, fib::sequence_reader& reader, fib::spiral_index& index)
+{
+	fib::spiral_index_builder builder{};
+	builder.reserve(reader.size() - args.first);
+
+	std::size_t skip = args.first;
+	int previous = 0;
+	bool started = false;
+	auto const read = reader.for_each_chunk([&](int const* first, int const* last)
+	{
+		auto const skipped = std::min<std::size_t>(skip, last - first);
+		skip -= skipped;
+		first += skipped;
+		if (first == last)
+			return;
+
+		if (started)
+		{
+			int const seam[] = { previous, *first };
+			builder.append(seam, seam + 2);
+		}
+		builder.append(first, last);
+		previous = *(last - 1);
+		started = true;
+	});
+
+	if (!read)
+		return false;
+	index = builder.build();
+	return true;
+}
+
+static int raster(int argc, char** argv)
+{
+	using clock = std::chrono::steady_clock;
+
+	spiral_arguments args{};
+	fib::raster_options options{};
+	std::string output = "fibonacci.png";
+	std::size_t memory = 0;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		std::string_view arg(argv[i]);
+		bool has_value = i + 1 < argc;
+
+		if (parse_spiral_argument(argc, argv, i, args)) continue;
+		else if (arg == "--width" && has_value) options.width = std::atoi(argv[++i]);
+		else if (arg == "--height" && has_value) options.height = std::atoi(argv[++i]);
+		else if (arg == "--tile" && has_value) options.tile_size = std::atoi(argv[++i]);
+		else if (arg == "--threads" && has_value) options.threads = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--thickness" && has_value) options.thickness = std::atoi(argv[++i]);
+		else if (arg == "--no-arcs") options.arcs = false;
+		else if (arg == "--memory" && has_value) memory = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--output" && has_value) output = argv[++i];
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	if (options.width <= 0 || options.height <= 0)
+	{
+		fprintf(stderr, "invalid image size %dx%d\n", options.width, options.height);
+		return 1;
+	}
+
+	// the rasterizer tiles over every point, only the terms are streamed
+	fib::spiral_index index{};
+	if (!args.input.empty() && memory != 0)
+	{
+		fib::sequence_reader reader{};
+		if (!open_reader(args, memory, reader) || !stream_spiral_index(args, reader, index))
+			return 1;
+
+		printf("streamed %d terms through %d bytes of buffers\n", (int)reader.size(), (int)reader.buffer_bytes());
+	}
+	else
+	{
+		sequence_terms fibonacci{};
+		if (!load_sequence(args, fibonacci))
+			return 1;
+
+		index = fib::spiral_index(fibonacci.begin() + args.first, fibonacci.end());
+	}
+
+	fib::raster_image image{};
+	auto const stats = fib::rasterize(index, options, image);
+	printf("rasterized %d squares into %dx%d in %.3f ms: %.1f MP/s on %u threads (%d tiles)\n",
+		(int)index.size(), image.width, image.height, stats.seconds * 1e3,
+		stats.megapixels_per_second, stats.threads, (int)stats.tiles);
+
+	// stb encodes on this thread alone, at 16K x 16K it takes far longer than the rasterizer
+	auto const encode_start = clock::now();
+	if (!stbi_write_png(output.c_str(), image.width, image.height, 1, image.pixels.get(), image.width))
+	{
+		fprintf(stderr, "cannot write '%s'\n", output.c_str());
+		return 1;
+	}
+	auto const encode_seconds = std::chrono::duration<double>(clock::now() - encode_start).count();
+	printf("wrote '%s' in %.3f ms: %.1f MP/s encoding on one thread\n", output.c_str(), encode_seconds * 1e3,
+		double(image.width) * double(image.height) / 1e6 / std::max(encode_seconds, 1e-9));
+
+	return 0;
+}
+
+static int svg(int argc, char** argv)
+{
+	spiral_arguments args{};
+	fib::svg_options options{};
+	std::string output = "fibonacci.svg";
+	std::size_t memory = 0;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		std::string_view arg(argv[i]);
+		bool has_value = i + 1 < argc;
+
+		if (parse_spiral_argument(argc, argv, i, args)) continue;
+		else if (arg == "--width" && has_value) options.width = std::atof(argv[++i]);
+		else if (arg == "--precision" && has_value) options.precision = std::atoi(argv[++i]);
+		else if (arg == "--min-size" && has_value) options.min_size = std::atof(argv[++i]);
+		else if (arg == "--max-bytes" && has_value) options.max_bytes = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--no-arcs") options.arcs = false;
+		else if (arg == "--memory" && has_value) memory = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--output" && has_value) output = argv[++i];
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	fib::svg_stats stats{};
+	if (!args.input.empty() && memory != 0)
+	{
+		// both svg passes stream the file, memory use stays at the buffer pool whatever the file size
+		fib::sequence_reader reader{};
+		if (!open_reader(args, memory, reader))
+			return 1;
+
+		auto for_each_term = [&](auto&& visit)
+		{
+			std::size_t skip = args.first;
+			return reader.for_each_chunk([&](int const* first, int const* last)
+			{
+				auto const skipped = std::min<std::size_t>(skip, last - first);
+				skip -= skipped;
+				for (first += skipped; first != last; ++first)
+					visit(*first);
+			});
+		};
+
+		if (!fib::write_svg(output, for_each_term, options, stats))
+		{
+			fprintf(stderr, "cannot write '%s'\n", output.c_str());
+			return 1;
+		}
+
+		printf("streamed %d terms through %d bytes of buffers\n", (int)reader.size(), (int)reader.buffer_bytes());
+	}
+	else
+	{
+		sequence_terms fibonacci{};
+		if (!load_sequence(args, fibonacci))
+			return 1;
+
+		if (!fib::write_svg(output, fibonacci.begin() + args.first, fibonacci.end(), options, stats))
+		{
+			fprintf(stderr, "cannot write '%s'\n", output.c_str());
+			return 1;
+		}
+	}
+
+	printf("wrote '%s': %d squares, %d dropped, %d bytes in %.3f ms (%.1f MB/s)\n",
+		output.c_str(), (int)stats.squares_written, (int)stats.squares_dropped, (int)stats.bytes,
+		stats.seconds * 1e3, stats.bytes / 1e6 / std::max(stats.seconds, 1e-9));
+
+	return 0;
+}
+
+static std::size_t file_size(std::string const& filename)
+{
+	std::ifstream ifs{ filename, std::ios::binary | std::ios::ate };
+	return ifs.is_open() ? static_cast<std::size_t>(ifs.tellg()) : 0;
+}
+
+static int pack(int argc, char** argv)
+{
+	using clock = std::chrono::steady_clock;
+
+	spiral_arguments args{};
+	std::string output = "fibonacci.bin";
+	std::size_t block_terms = fib::sequence_block_terms;
+	unsigned int threads = 0;
+	bool big = false;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		std::string_view arg(argv[i]);
+		bool has_value = i + 1 < argc;
+
+		if (parse_spiral_argument(argc, argv, i, args)) continue;
+		else if (arg == "--big") big = true;
+		else if (arg == "--block" && has_value) block_terms = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--threads" && has_value) threads = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--output" && has_value) output = argv[++i];
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	// the whole sequence is packed, --first only matters for drawing
+	std::size_t raw_bytes = 0;
+	bool written = false, same = false;
+	double encode_seconds = 0., decode_seconds = 0.;
+	if (big)
+	{
+		fib::limb_sequence fibonacci{};
+		if (!load_big_sequence(args, fibonacci))
+			return 1;
+		raw_bytes = fibonacci.data.size() * sizeof(std::uint32_t);
+
+		auto const start = clock::now();
+		written = fib::write_compact_sequence(output, fibonacci, 0, 0, 1, block_terms, threads);
+		auto const encoded = clock::now();
+
+		fib::limb_sequence decoded{};
+		same = written && fib::read_sequence(output, decoded) && decoded.data == fibonacci.data;
+		encode_seconds = std::chrono::duration<double>(encoded - start).count();
+		decode_seconds = std::chrono::duration<double>(clock::now() - encoded).count();
+	}
+	else
+	{
+		sequence_terms fibonacci{};
+		if (!load_sequence(args, fibonacci))
+			return 1;
+		raw_bytes = fibonacci.size() * sizeof(int);
+
+		auto const start = clock::now();
+		written = fib::write_compact_sequence(output, fibonacci.begin(), fibonacci.size(), 0, fibonacci.begin()[0], fibonacci.begin()[1], block_terms, threads);
+		auto const encoded = clock::now();
+
+		std::vector<int> decoded{};
+		same = written && fib::read_sequence(output, decoded) && std::equal(decoded.cbegin(), decoded.cend(), fibonacci.begin(), fibonacci.end());
+		encode_seconds = std::chrono::duration<double>(encoded - start).count();
+		decode_seconds = std::chrono::duration<double>(clock::now() - encoded).count();
+	}
+
+	if (!written)
+	{
+		fprintf(stderr, "cannot write '%s'\n", output.c_str());
+		return 1;
+	}
+	if (!same)
+	{
+		fprintf(stderr, "'%s' does not decode to the packed terms\n", output.c_str());
+		return 1;
+	}
+
+	auto const packed_bytes = file_size(output);
+	printf("packed %d bytes of terms into %d bytes (ratio %.1f) in %.3f ms\n",
+		(int)raw_bytes, (int)packed_bytes, double(raw_bytes) / std::max<double>(packed_bytes, 1.), encode_seconds * 1e3);
+	printf("read and decoded in %.3f ms (%.2f GB/s of terms)\n", decode_seconds * 1e3, raw_bytes / 1e9 / std::max(decode_seconds, 1e-9));
+
+	return 0;
+}
+
+static int text(int argc, char** argv)
+{
+	spiral_arguments args{};
+	fib::text_options options{};
+	std::string output = "fibonacci.txt";
+	bool big = false;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		std::string_view arg(argv[i]);
+		bool has_value = i + 1 < argc;
+
+		if (parse_spiral_argument(argc, argv, i, args)) continue;
+		else if (arg == "--big") big = true;
+		else if (arg == "--threads" && has_value) options.threads = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--chunk" && has_value) options.chunk_terms = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--output" && has_value) output = argv[++i];
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	fib::text_stats stats{};
+	bool written = false;
+	if (big)
+	{
+		fib::limb_sequence fibonacci{};
+		if (!load_big_sequence(args, fibonacci))
+			return 1;
+
+		written = fib::write_text(output, fibonacci, options, stats);
+	}
+	else
+	{
+		sequence_terms fibonacci{};
+		if (!load_sequence(args, fibonacci))
+			return 1;
+
+		written = fib::write_text(output, fibonacci.begin(), fibonacci.size(), options, stats);
+	}
+
+	if (!written)
+	{
+		fprintf(stderr, "cannot write '%s'\n", output.c_str());
+		return 1;
+	}
+
+	printf("wrote '%s': %d bytes in %.3f ms (%.1f MB/s on %u threads)\n",
+		output.c_str(), (int)stats.bytes, stats.seconds * 1e3, stats.bytes / 1e6 / std::max(stats.seconds, 1e-9), stats.threads);
+
+	return 0;
+}
+
+static int validate(int argc, char** argv)
+{
+	using clock = std::chrono::steady_clock;
+
+	spiral_arguments args{};
+	unsigned int threads = 0;
+	bool big = false;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		std::string_view arg(argv[i]);
+		bool has_value = i + 1 < argc;
+
+		if (parse_spiral_argument(argc, argv, i, args)) continue;
+		else if (arg == "--big") big = true;
+		else if (arg == "--threads" && has_value) threads = std::strtoul(argv[++i], nullptr, 10);
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	// the check is reported next to the load it would be added to
+	auto const start = clock::now();
+	fib::validation_stats stats{};
+	std::size_t count = 0, at = 0;
+	if (big)
+	{
+		fib::limb_sequence fibonacci{};
+		if (!load_big_sequence(args, fibonacci))
+			return 1;
+
+		count = fibonacci.size();
+		at = fib::find_recurrence_break(fibonacci, threads, stats);
+	}
+	else
+	{
+		sequence_terms fibonacci{};
+		if (!load_sequence(args, fibonacci))
+			return 1;
+
+		count = fibonacci.size();
+		at = fib::find_recurrence_break(fibonacci.begin(), count, threads, stats);
+		if (at != count)
+			fprintf(stderr, "term %d breaks the recurrence: %d + %d != %d\n", (int)at, fibonacci.begin()[at - 2], fibonacci.begin()[at - 1], fibonacci.begin()[at]);
+	}
+	auto const total_seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+	if (at != count)
+	{
+		if (big)
+			fprintf(stderr, "term %d breaks the recurrence\n", (int)at);
+		return 1;
+	}
+
+	printf("%d terms follow the recurrence, checked in %.3f ms on %u threads, %.1f%% of loading and checking\n",
+		(int)count, stats.seconds * 1e3, stats.threads, 100. * stats.seconds / std::max(total_seconds, 1e-9));
+
+	return 0;
+}
+
+static int scale(int argc, char** argv)
+{
+	using clock = std::chrono::steady_clock;
+
+	unsigned int pool_threads = 0;
+	std::size_t terms = 20000000;
+	int width = 4096;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		std::string_view arg(argv[i]);
+		bool has_value = i + 1 < argc;
+
+		if (arg == "--pool" && has_value) pool_threads = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--terms" && has_value) terms = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--width" && has_value) width = std::atoi(argv[++i]);
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	fib::set_default_pool_threads(pool_threads);
+	auto& pool = fib::default_pool();
+	auto seconds_since = [](clock::time_point start) { return std::chrono::duration<double>(clock::now() - start).count(); };
+
+	// what the pool saves per job over the thread per generation it replaced
+	constexpr int jobs = 2000;
+	auto start = clock::now();
+	for (int i = 0; i < jobs; ++i)
+		std::thread{ []() {} }.join();
+	auto const thread_us = seconds_since(start) * 1e6 / jobs;
+
+	start = clock::now();
+	for (int i = 0; i < jobs; ++i)
+		pool.submit([]() {}).get();
+	auto const pool_us = seconds_since(start) * 1e6 / jobs;
+	printf("job start and finish: %.1f us on a new thread, %.1f us on the pool (%u threads)\n", thread_us, pool_us, pool.size());
+
+	// the int terms wrap, which the checks and the coder expect
+	auto const sequence = fib::make_fibonacci_sequence(terms - 1);
+	auto const* words = reinterpret_cast<std::uint32_t const*>(sequence.data());
+	std::vector<std::uint64_t> offsets{};
+	std::vector<unsigned char> blocks{};
+	fib::codec::encode_blocks(words, sequence.size(), 1, fib::sequence_block_terms, 0, offsets, blocks);
+	std::vector<std::uint32_t> decoded(sequence.size());
+
+	auto const generated = fib::make_fibonacci_sequence(30);
+	auto const index = fib::spiral_index(generated.cbegin(), generated.cend());
+	fib::raster_image image{};
+
+	struct stage
+	{
+		char const* name;
+		std::function<void(unsigned int)> run;
+	};
+	stage const stages[] = {
+		{ "validate", [&](unsigned int threads) { fib::validation_stats stats{}; fib::find_recurrence_break(sequence.data(), sequence.size(), threads, stats); } },
+		{ "encode", [&](unsigned int threads) { fib::codec::encode_blocks(words, sequence.size(), 1, fib::sequence_block_terms, threads, offsets, blocks); } },
+		{ "decode", [&](unsigned int threads) { fib::codec::decode_blocks(blocks.data(), offsets.data(), sequence.size(), 1, fib::sequence_block_terms, threads, decoded.data()); } },
+		{ "raster", [&](unsigned int threads) { fib::raster_options options{}; options.width = options.height = width; options.threads = threads; fib::rasterize(index, options, image); } },
+	};
+
+	// the caller takes part in every stage, so 1 thread is the caller alone
+	printf("%-10s %8s %10s %8s\n", "stage", "threads", "ms", "speedup");
+	for (auto const& s : stages)
+	{
+		double single = 0.;
+		for (unsigned int threads = 1; threads <= pool.size() + 1; threads *= 2)
+		{
+			s.run(threads);
+			start = clock::now();
+			s.run(threads);
+			auto const seconds = seconds_since(start);
+			if (threads == 1)
+				single = seconds;
+			printf("%-10s %8u %10.3f %8.2f\n", s.name, threads, seconds * 1e3, single / std::max(seconds, 1e-9));
+		}
+	}
+
+	auto const stats = pool.stats();
+	printf("pool ran %llu tasks, %llu stolen\n", (unsigned long long)stats.executed, (unsigned long long)stats.stolen);
+
+	return 0;
+}
+
+// the queue geometry_stream used before the ring, bounded the same way for the comparison
+template <class T>
+class mutex_queue
+{
+private:
+	std::mutex mutex_{};
+	std::deque<T> items_{};
+	std::size_t capacity_;
+
+public:
+	explicit mutex_queue(std::size_t capacity) : capacity_(capacity) {}
+
+	bool try_push(T&& value)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (items_.size() == capacity_)
+			return false;
+		items_.push_back(std::move(value));
+		return true;
+	}
+
+	bool try_pop(T& value)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (items_.empty())
+			return false;
+		value = std::move(items_.front());
+		items_.pop_front();
+		return true;
+	}
+};
+
+static int ring(int argc, char** argv)
+{
+	using clock = std::chrono::steady_clock;
+
+	std::size_t items = 1000000;
+	std::size_t capacity = 1024;
+	std::size_t squares = 0;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		std::string_view arg(argv[i]);
+		bool has_value = i + 1 < argc;
+
+		if (arg == "--items" && has_value) items = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--capacity" && has_value) capacity = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--squares" && has_value) squares = std::strtoull(argv[++i], nullptr, 10);
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	struct item
+	{
+		clock::time_point pushed{};
+		std::vector<fib::square> squares{};
+	};
+
+	// one producer and one consumer thread, both yield while they cannot go on
+	auto measure = [&](char const* name, auto& queue)
+	{
+		std::vector<double> latencies(items);
+		auto const start = clock::now();
+
+		std::thread producer([&]()
+		{
+			for (std::size_t i = 0; i < items; ++i)
+			{
+				item next{ {}, std::vector<fib::square>(squares) };
+				next.pushed = clock::now();
+				while (!queue.try_push(std::move(next)))
+					std::this_thread::yield();
+			}
+		});
+
+		item taken{};
+		for (std::size_t i = 0; i < items;)
+		{
+			if (!queue.try_pop(taken))
+			{
+				std::this_thread::yield();
+				continue;
+			}
+			latencies[i++] = std::chrono::duration<double, std::micro>(clock::now() - taken.pushed).count();
+		}
+		producer.join();
+
+		auto const seconds = std::chrono::duration<double>(clock::now() - start).count();
+		std::sort(latencies.begin(), latencies.end());
+		auto const at = [&](double q) { return latencies.empty() ? 0. : latencies[std::min(latencies.size() - 1, std::size_t(q * latencies.size()))]; };
+		printf("%-8s %12.0f %10.2f %10.2f %10.2f %10.2f\n", name, items / std::max(seconds, 1e-9), at(0.5), at(0.99), at(0.999), at(1.));
+	};
+
+	printf("%zu items of %zu squares, %zu in flight, %u hardware threads\n", items, squares, capacity, std::thread::hardware_concurrency());
+	printf("%-8s %12s %10s %10s %10s %10s\n", "queue", "items/s", "p50 us", "p99 us", "p99.9 us", "max us");
+
+	mutex_queue<item> locked{ capacity };
+	measure("mutex", locked);
+
+	fib::spsc_ring<item> lock_free{ capacity };
+	measure("spsc", lock_free);
+
+	return 0;
+}
+
+// a hardware or software event of this thread and the ones it starts, -1 where perf events are unavailable
+class perf_counter
+{
+private:
+	int fd_ = -1;
+
+public:
+	perf_counter(std::uint32_t type, std::uint64_t config)
+	{
+#if defined(__linux__)
+		perf_event_attr attr{};
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = 1;
+		attr.inherit = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#else
+		(void)type;
+		(void)config;
+#endif
+	}
+
+	perf_counter(perf_counter const&) = delete;
+	perf_counter& operator=(perf_counter const&) = delete;
+
+	~perf_counter()
+	{
+#if defined(__linux__)
+		if (fd_ >= 0)
+			close(fd_);
+#endif
+	}
+
+	template <class Function>
+	long long measure(Function&& function)
+	{
+#if defined(__linux__)
+		if (fd_ >= 0)
+		{
+			ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+		}
+#endif
+		function();
+		long long count = -1;
+#if defined(__linux__)
+		if (fd_ >= 0)
+		{
+			ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+			if (read(fd_, &count, sizeof(count)) != sizeof(count))
+				count = -1;
+		}
+#endif
+		return count;
+	}
+};
+
+// kB of anonymous memory backed by transparent huge pages, -1 off linux
+static long long anon_huge_kilobytes()
+{
+	long long kilobytes = -1;
+	std::ifstream smaps("/proc/self/smaps_rollup");
+	for (std::string line{}; std::getline(smaps, line);)
+	{
+		if (line.rfind("AnonHugePages:", 0) == 0)
+			kilobytes = std::atoll(line.c_str() + 14);
+	}
+	return kilobytes;
+}
+
+static int pages(int argc, char** argv)
+{
+	using clock = std::chrono::steady_clock;
+
+	std::size_t terms = 20000000;
+	std::size_t big = 50000;
+	std::size_t probes = 10000000;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		std::string_view arg(argv[i]);
+		bool has_value = i + 1 < argc;
+
+		if (arg == "--terms" && has_value) terms = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--big" && has_value) big = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--probes" && has_value) probes = std::strtoull(argv[++i], nullptr, 10);
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	terms = std::max<std::size_t>(terms, 3);
+	big = std::max<std::size_t>(big, 3);
+
+#if defined(__linux__)
+	auto const dtlb_read_misses = (PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	perf_counter dtlb(PERF_TYPE_HW_CACHE, dtlb_read_misses);
+	perf_counter faults(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+#else
+	perf_counter dtlb(0, 0);
+	perf_counter faults(0, 0);
+#endif
+
+	auto const sequence = fib::make_fibonacci_sequence(terms - 1);
+	printf("%d int terms, %d big integer terms, %d probes, %u pool threads\n", (int)terms, (int)big, (int)probes, fib::default_pool().size());
+	printf("%-12s %-10s %10s %12s %14s %12s\n", "mode", "stage", "ms", "rate", "dTLB misses", "page faults");
+
+	for (auto const mode : { fib::page_mode::standard, fib::page_mode::transparent, fib::page_mode::hugetlb })
+	{
+		fib::set_page_mode(mode);
+
+		auto report = [&](char const* stage, double seconds, double rate, char const* unit, long long misses, long long faulted)
+		{
+			char misses_text[32] = "n/a", faults_text[32] = "n/a";
+			if (misses >= 0)
+				snprintf(misses_text, sizeof(misses_text), "%lld", misses);
+			if (faulted >= 0)
+				snprintf(faults_text, sizeof(faults_text), "%lld", faulted);
+			printf("%-12s %-10s %10.1f %7.1f %-4s %14s %12s\n", fib::page_mode_name(mode), stage, seconds * 1e3, rate, unit, misses_text, faults_text);
+		};
+
+		// each stage runs once per counter, the times are of the first run
+		fib::limb_sequence limbs{};
+		auto start = clock::now();
+		auto faulted = faults.measure([&]() { limbs = fib::make_fibonacci_limbs(big - 1); });
+		auto seconds = std::chrono::duration<double>(clock::now() - start).count();
+		auto misses = dtlb.measure([&]() { fib::make_fibonacci_limbs(big - 1); });
+		auto const limb_bytes = limbs.data.size() * sizeof(std::uint32_t);
+		report("generate", seconds, limb_bytes / 1e6 / seconds, "MB/s", misses, faulted);
+
+		fib::validation_stats stats{};
+		start = clock::now();
+		faulted = faults.measure([&]() { fib::find_recurrence_break(limbs, 0, stats); });
+		seconds = std::chrono::duration<double>(clock::now() - start).count();
+		misses = dtlb.measure([&]() { fib::find_recurrence_break(limbs, 0, stats); });
+		report("validate", seconds, limb_bytes / 1e6 / seconds, "MB/s", misses, faulted);
+
+		fib::spiral_index index{};
+		start = clock::now();
+		faulted = faults.measure([&]() { index = fib::spiral_index(sequence.cbegin(), sequence.cend()); });
+		seconds = std::chrono::duration<double>(clock::now() - start).count();
+		misses = dtlb.measure([&]() { fib::spiral_index(sequence.cbegin(), sequence.cend()); });
+		report("points", seconds, index.points().size() / 1e6 / seconds, "M/s", misses, faulted);
+
+		// the reads a deep zoom makes, scattered over the whole buffer, one TLB lookup each
+		auto const& points = index.points();
+		auto probe = [&]()
+		{
+			std::uint64_t state = 0x9e3779b97f4a7c15ull;
+			double sum = 0.;
+			for (std::size_t i = 0; i < probes; ++i)
+			{
+				state = state * 6364136223846793005ull + 1442695040888963407ull;
+				sum += points[(state >> 33) % points.size()].x;
+			}
+			return sum;
+		};
+		volatile double sink = 0.;
+		start = clock::now();
+		faulted = faults.measure([&]() { sink = probe(); });
+		seconds = std::chrono::duration<double>(clock::now() - start).count();
+		misses = dtlb.measure([&]() { sink = probe(); });
+		report("probe", seconds, probes / 1e6 / seconds, "M/s", misses, faulted);
+
+		printf("%-12s %-10s %lld kB on transparent huge pages\n", fib::page_mode_name(mode), "", anon_huge_kilobytes());
+	}
+
+	auto const stats = fib::get_page_stats();
+	printf("%.1f MB mapped for huge pages, %.1f MB of them reserved, %llu hugetlb requests fell back to transparent\n",
+		stats.mapped_bytes / 1e6, stats.hugetlb_bytes / 1e6, (unsigned long long)stats.fallbacks);
+	return 0;
+}
+
+#if !defined(_WIN32)
+
+static std::atomic<bool> serve_stop{ false };
+
+static int serve(int argc, char** argv)
+{
+	std::string socket = "fibonacci.sock";
+	unsigned int threads = 0;
+	fib::spiral_server_options options{};
+
+	for (int i = 0; i < argc; ++i)
+	{
+		std::string_view arg(argv[i]);
+		bool has_value = i + 1 < argc;
+
+		if (arg == "--socket" && has_value) socket = argv[++i];
+		else if (arg == "--threads" && has_value) threads = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--cache" && has_value) options.cache_bytes = std::size_t(std::strtoull(argv[++i], nullptr, 10)) << 20;
+		else if (arg == "--backlog" && has_value) options.client_output_bytes = std::size_t(std::strtoull(argv[++i], nullptr, 10)) << 20;
+		else if (arg == "--max-second" && has_value) options.limits.max_second = std::strtoul(argv[++i], nullptr, 10);
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	fib::set_default_pool_threads(threads);
+	fib::spiral_server server(options);
+	if (!server.listen(socket))
+		return 1;
+
+	struct sigaction action{};
+	action.sa_handler = [](int) { serve_stop = true; };
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+
+	printf("serving on '%s' with %u pool threads\n", socket.c_str(), fib::default_pool().size());
+	server.run(serve_stop);
+
+	auto const stats = server.stats();
+	printf("%llu connections, %llu requests: %llu cache hits, %llu batched onto %llu jobs, %llu rejected, %llu failed\n",
+		(unsigned long long)stats.connections, (unsigned long long)stats.requests, (unsigned long long)stats.cache_hits,
+		(unsigned long long)stats.batched, (unsigned long long)stats.jobs, (unsigned long long)stats.rejected, (unsigned long long)stats.failed);
+	printf("sent %.1f MB, cache holds %d results in %.1f MB\n",
+		stats.bytes_sent / 1e6, (int)stats.cache_entries, stats.cache_bytes / 1e6);
+	return 0;
+}
+
+static int loadgen(int argc, char** argv)
+{
+	using clock = std::chrono::steady_clock;
+
+	std::string socket = "fibonacci.sock";
+	unsigned int clients = 8;
+	std::size_t requests = 1000;
+	std::string kind = "points";
+	std::uint32_t second = fib::service_max_second;
+	std::uint32_t distinct = 16;
+	std::uint32_t width = 256;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		std::string_view arg(argv[i]);
+		bool has_value = i + 1 < argc;
+
+		if (arg == "--socket" && has_value) socket = argv[++i];
+		else if (arg == "--clients" && has_value) clients = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--requests" && has_value) requests = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--kind" && has_value) kind = argv[++i];
+		else if (arg == "--second" && has_value) second = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--distinct" && has_value) distinct = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--width" && has_value) width = std::strtoul(argv[++i], nullptr, 10);
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	fib::service_request request{};
+	request.kind = kind == "sequence" ? fib::service_kind::sequence : kind == "raster" ? fib::service_kind::raster : fib::service_kind::points;
+	if (request.kind == fib::service_kind::points && kind != "points")
+	{
+		usage();
+		return 1;
+	}
+	request.width = request.height = width;
+	clients = std::max(clients, 1u);
+	distinct = std::clamp<std::uint32_t>(distinct, 1, std::max(second, 1u));
+
+	struct client_result
+	{
+		std::vector<double> latencies{};
+		std::size_t cached = 0;
+		std::size_t errors = 0;
+		std::uint64_t bytes = 0;
+	};
+	std::vector<client_result> results(clients);
+
+	// every client walks the distinct requests from its own random offset, so they overlap
+	auto const start = clock::now();
+	std::vector<std::thread> threads{};
+	for (unsigned int c = 0; c < clients; ++c)
+	{
+		threads.emplace_back([&, c]()
+		{
+			auto& result = results[c];
+			fib::service_client client{};
+			if (!client.connect(socket))
+			{
+				fprintf(stderr, "cannot connect to '%s'\n", socket.c_str());
+				result.errors = requests;
+				return;
+			}
+
+			std::mt19937 random(c);
+			auto const offset = random() % distinct;
+			fib::service_response response{};
+			std::vector<unsigned char> payload{};
+			result.latencies.reserve(requests);
+			for (std::size_t i = 0; i < requests; ++i)
+			{
+				auto next = request;
+				next.second = second - std::uint32_t((offset + i) % distinct);
+				next.tag = i;
+
+				auto const sent = clock::now();
+				if (!client.call(next, response, payload) || response.tag != i || response.status != fib::service_status::ok)
+				{
+					++result.errors;
+					continue;
+				}
+				result.latencies.push_back(std::chrono::duration<double, std::milli>(clock::now() - sent).count());
+				result.cached += response.cached;
+				result.bytes += payload.size();
+			}
+		});
+	}
+	for (auto& t : threads)
+		t.join();
+	auto const seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+	std::vector<double> latencies{};
+	std::size_t cached = 0, errors = 0;
+	std::uint64_t bytes = 0;
+	for (auto const& r : results)
+	{
+		latencies.insert(latencies.end(), r.latencies.begin(), r.latencies.end());
+		cached += r.cached;
+		errors += r.errors;
+		bytes += r.bytes;
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+	auto const at = [&](double q) { return latencies.empty() ? 0. : latencies[std::min(latencies.size() - 1, std::size_t(q * latencies.size()))]; };
+	printf("%u clients x %zu %s requests, %u distinct: %.0f requests/s, %.1f MB/s, %.1f%% from the cache, %zu errors\n",
+		clients, requests, kind.c_str(), distinct, latencies.size() / std::max(seconds, 1e-9), bytes / 1e6 / std::max(seconds, 1e-9),
+		latencies.empty() ? 0. : 100. * cached / latencies.size(), errors);
+	printf("latency ms: p50 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n", at(0.5), at(0.99), at(0.999), at(1.));
+	return errors == 0 ? 0 : 1;
+}
+
+#else
+
+static int serve(int, char**)
+{
+	fprintf(stderr, "serve needs unix domain sockets\n");
+	return 1;
+}
+
+static int loadgen(int, char**)
+{
+	fprintf(stderr, "loadgen needs unix domain sockets\n");
+	return 1;
+}
+
+#endif
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		usage();
+		return 1;
+	}
+
+	std::string_view command(argv[1]);
+	if (command == "raster")
+		return raster(argc - 2, argv + 2);
+	if (command == "svg")
+		return svg(argc - 2, argv + 2);
+	if (command == "pack")
+		return pack(argc - 2, argv + 2);
+	if (command == "text")
+		return text(argc - 2, argv + 2);
+	if (command == "validate")
+		return validate(argc - 2, argv + 2);
+	if (command == "scale")
+		return scale(argc - 2, argv + 2);
+	if (command == "ring")
+		return ring(argc - 2, argv + 2);
+	if (command == "serve")
+		return serve(argc - 2, argv + 2);
+	if (command == "loadgen")
+		return loadgen(argc - 2, argv + 2);
+	if (command == "pages")
+		return pages(argc - 2, argv + 2);
+
+	usage();
+	return 1;
+}
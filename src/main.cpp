@@ -11,16 +11,38 @@
 #include "imgui_impl_opengl3.h"
 
 #include "matrix.h";
+#include "square_renderer.h"
+#include "camera.h"
+#include "spiral.h"
+#include "sequence.h"
+#include "sequence_file.h"
+#include "mapped_file.h"
+#include "geometry_stream.h"
+#include "geometry_cache.h"
+#include "background_writer.h"
+#include "text_writer.h"
+#include "text_reader.h"
+#include "file_watcher.h"
+#include "sequence_validation.h"
+#include "cancellation.h"
+#include "thread_pool.h"
+#include "job_scheduler.h"
+#include "pipeline.h"
 
 #include <stdio.h>
 #include <vector>
 #include <algorithm>
-#include <numeric>
 #include <string>
 #include <string_view>
 #include <atomic>
 #include <thread>
-#include <fstream>
+#include <memory>
+#include <utility>
+#include <filesystem>
+#include <system_error>
+#include <tuple>
+#include <cmath>
+#include <chrono>
 
 // About Desktop OpenGL function loaders:
 //  Modern desktop OpenGL doesn't have a standard portable header file to load OpenGL function pointers.
@@ -51,19 +73,27 @@ static void glfw_error_callback(int error, const char* description)
     fprintf(stderr, "Glfw Error %d: %s\n", error, description);
 }
 
-template <class FibonacciRandomAccessIt>
-auto get_fibonacci_points(FibonacciRandomAccessIt begin, FibonacciRandomAccessIt end) -> std::vector<ImVec2>;
+// float spiral points for the ui and their bounds
+struct fibonacci_points
+{
+	std::vector<ImVec2, fib::huge_page_allocator<ImVec2>> points{};
+	float min_x = 0.f, min_y = 0.f, max_x = 0.f, max_y = 0.f;
+};
+
+template <class FibonacciRandomAccessIt, class OnChunk>
+auto get_fibonacci_points(FibonacciRandomAccessIt begin, FibonacciRandomAccessIt end, fib::cancellation_token const& cancel, OnChunk&& on_chunk) -> fibonacci_points;
+
+// first and second number, file to load, save, file version: everything a generation depends on, by value
+using request_key = std::tuple<unsigned int, unsigned int, std::string, bool, std::uint64_t>;
+
+std::shared_ptr<fib::spiral_index> build_fibonacci_spiral(
+	request_key const& request,
+	fib::job_context const& context,
+	fib::geometry_stream& stream,
+	fib::background_writer& writer,
+	fib::background_writer& cache_writer);
 
-std::thread render_fibonacci_spiral(
-	int window_width, 
-	int window_height, 
-	unsigned int first_fibonacci_number, 
-	unsigned int second_fibonacci_number, 
-	std::atomic<bool>& started, 
-	std::atomic<bool>& sequence_ready, 
-	std::atomic<bool>& proceed,
-	std::string_view load_filename, 
-	bool save = false);
+void draw_squares(ImDrawList* draw_list, std::vector<fib::square> const& squares, fib::camera2d const& camera, ImVec2 const& viewport_size, double budget_ms);
 
 int main(int, char**)
 {
@@ -81,10 +111,10 @@ int main(int, char**)
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);  // 3.2+ only
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);            // Required on Mac
 #else
-    // GL 3.0 + GLSL 130
+    // GL 3.3 + GLSL 130, 3.3 is needed by the instanced square renderer
     const char* glsl_version = "#version 130";
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     //glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);  // 3.2+ only
     //glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);            // 3.0+ only
 #endif
@@ -126,6 +156,17 @@ int main(int, char**)
     ImGui_ImplGlfw_InitForOpenGL(window, true);
     ImGui_ImplOpenGL3_Init(glsl_version);
 
+	fib::instanced_square_renderer square_renderer;
+	if (!square_renderer.init())
+	{
+		fprintf(stderr, "Instanced square renderer unavailable, falling back to ImGui rectangles\n");
+	}
+
+	// progressive rendering: instances uploaded and milliseconds spent on ImGui rectangles per frame
+	static auto const upload_budget = std::size_t(1) << 16;
+	static auto const draw_budget_ms = 8.;
+	square_renderer.upload_budget(upload_budget);
+
     // Our state
     bool show_demo_window = true;
     bool show_another_window = false;
@@ -137,10 +178,69 @@ int main(int, char**)
 	bool pressed = false;
 	bool save = false;
 	bool load = false;
-	std::atomic<bool> started = false;
-	std::atomic<bool> sequence_ready = false;
-	std::atomic<bool> proceed = false;
-	std::thread worker_thread{};
+	bool instanced = square_renderer.initialized();
+
+	// saves run here, the worker only hands over a copy of the terms
+	fib::background_writer writer{};
+	// geometry cache files, a write for a generation that was already replaced is dropped
+	fib::background_writer cache_writer{ 1 };
+
+	// metadata of the file to load, a change on disk is a new request and reloads it
+	fib::file_watcher load_watcher{};
+
+	// world space geometry of the last generation, only regenerated when the request changes
+	request_key cached_request{};
+	// a request the worker gave up on is not retried until it changes, e.g. the file on disk
+	request_key rejected_request{};
+	bool has_geometry = false;
+	fib::spiral_geometry geometry{};
+	fib::geometry_stream stream{};
+	std::vector<std::vector<fib::square>> chunks{};
+	bool streaming = false;
+	fib::camera2d camera{};
+	bool panning = false;
+
+	// deep zoom looks up the squares around the view relative to the corner of that region, and
+	// again only once the camera pans out of it or zooms
+	bool deep_zoom = false;
+	bool staged_deep_zoom = false;
+	bool visible_current = false;
+	bool visible_staged = false;
+	fib::spiral_index::bounds visible_region{};
+	double visible_min_size = 0.;
+	std::vector<fib::square> visible_squares{};
+
+	// generations run as jobs on the shared pool, each on its own copy of the request, so the text
+	// fields can change meanwhile. A new request cancels the job in flight and replaces a queued one.
+	using spiral_scheduler = fib::job_scheduler<request_key, std::shared_ptr<fib::spiral_index>>;
+	spiral_scheduler spiral_jobs{
+		[&](request_key const& request, fib::job_context const& context)
+		{
+			return build_fibonacci_spiral(request, context, stream, writer, cache_writer);
+		} };
+
+	// while generating is off, numbers that parse are generated ahead on a thread of their own and
+	// into a stream of their own, every edit cancels the last speculation. Generate adopts the
+	// speculation when the numbers match, finished or not.
+	bool speculate = true;
+	fib::thread_pool speculation_pool{ 1 };
+	fib::geometry_stream speculative_stream{};
+	spiral_scheduler speculative_jobs{
+		[&](request_key const& request, fib::job_context const& context)
+		{
+			return build_fibonacci_spiral(request, context, speculative_stream, writer, cache_writer);
+		}, {}, speculation_pool };
+	fib::job_ticket<std::shared_ptr<fib::spiral_index>> speculation{};
+	request_key speculation_request{};
+	// taken from the speculative stream every frame, so the speculation never waits on a full ring
+	std::vector<std::vector<fib::square>> speculative_chunks{};
+	int promoted = 0;
+
+	// the job whose squares are streamed in, its request, and the scheduler and stream it runs with
+	fib::job_ticket<std::shared_ptr<fib::spiral_index>> spiral_job{};
+	request_key spiral_job_request{};
+	spiral_scheduler* spiral_job_scheduler = &spiral_jobs;
+	fib::geometry_stream* spiral_job_stream = &stream;
 
     // Main loop
     while (!glfwWindowShouldClose(window))
@@ -157,12 +257,12 @@ int main(int, char**)
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
 
-		ImGui::Begin("Fibonacci golden ratio approximation");
+		ImGui::Begin("Fibonacci golden ratio approximation", nullptr, ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoScrollWithMouse);
 		ImGui::SetWindowSize(ImVec2((float)width, (float)height), ImGuiCond_::ImGuiCond_Always);
 		ImGui::SetWindowPos(ImVec2(0.f, 0.f), ImGuiCond_::ImGuiCond_Always);
 
 		ImGui::Begin("Input");
-		ImGui::SetWindowSize(ImVec2(300.f, 150.f), ImGuiCond_::ImGuiCond_Always);
+		ImGui::SetWindowSize(ImVec2(300.f, 290.f), ImGuiCond_::ImGuiCond_Always);
 
 		auto window_pos = ImGui::GetWindowPos();
 		ImGui::SetWindowPos(window_pos, ImGuiCond_::ImGuiCond_Always);
@@ -182,6 +282,8 @@ int main(int, char**)
 			ImGui::Text("Generating from numbers");
 		}
 
+		ImGui::Checkbox("Precompute while typing", &speculate);
+
 		if (ImGui::Button(save ? "Stop saving to file" : "Save fibonacci sequence"))
 		{
 			save = !save;
@@ -192,46 +294,184 @@ int main(int, char**)
 			ImGui::Text("Saving to 'fibonacci.bin'");
 		}
 
-		if (ImGui::Button(load ? "Stop generating from file" : "Load .bin fibonacci sequence"))
+		auto const write_status = writer.status();
+		if (write_status.busy || write_status.queued > 0)
+		{
+			ImGui::Text("Writing in the background, %d queued", (int)write_status.queued);
+		}
+		else if (write_status.completed + write_status.failed > 0)
+		{
+			ImGui::Text(write_status.last_ok ? "Wrote '%s' in %.1f ms" : "Writing '%s' failed after %.1f ms",
+				write_status.last_name.c_str(), write_status.last_seconds * 1e3);
+		}
+
+		if (ImGui::Button(load ? "Stop generating from file" : "Load .bin or .txt fibonacci sequence"))
 		{
 			load = !load;
 		}
 
-		ImGui::InputText("Path to .bin file", load_filename_buf, sizeof(load_filename_buf));
+		ImGui::InputText("Path to .bin or .txt file", load_filename_buf, sizeof(load_filename_buf));
 
-		if (load && !pressed)
+		if (load && !pressed && std::get<2>(rejected_request) == load_filename_buf)
 		{
-			ImGui::Text("Generating from file");
+			ImGui::Text("Cannot use this file, see the console");
+		}
+		else if (load && !pressed)
+		{
+			ImGui::Text(load_watcher.event_driven() ? "Generating from file, reloads on change" : "Generating from file, polling for changes");
+		}
+
+		if (square_renderer.initialized() && 
+			ImGui::Button(instanced ? "Use ImGui rectangles" : "Use instanced renderer"))
+		{
+			instanced = !instanced;
+		}
+
+		if (ImGui::Button(deep_zoom ? "Stop deep zoom" : "Deep zoom"))
+		{
+			deep_zoom = !deep_zoom;
+		}
+
+		if (deep_zoom)
+		{
+			ImGui::SameLine();
+			ImGui::Text("%.3g px/unit, %d squares", camera.scale_x(), (int)visible_squares.size());
+		}
+
+		// rolling average over the last 120 frames, compare both renderers at the same n
+		ImGui::Text("%s: %.3f ms/frame (%.1f FPS)", instanced ? "Instanced" : "AddRect", 1000.f / io.Framerate, io.Framerate);
+
+		// from the request to the job starting, and from there to its result
+		auto const job_stats = spiral_jobs.stats();
+		if (job_stats.done + job_stats.cancelled > 0)
+		{
+			ImGui::Text("Last job: %.1f ms queued, %.1f ms run", job_stats.last.queued_ms, job_stats.last.run_ms);
+			ImGui::Text("Jobs: %d done, %d cancelled, %d superseded",
+				(int)job_stats.done, (int)job_stats.cancelled, (int)job_stats.superseded);
+		}
+
+		auto const speculation_stats = speculative_jobs.stats();
+		if (speculation_stats.done + speculation_stats.cancelled > 0)
+		{
+			ImGui::Text("Precomputed: %d done, %d cancelled, %d used",
+				(int)speculation_stats.done, (int)speculation_stats.cancelled, promoted);
+		}
+
+		if (streaming || (instanced && square_renderer.uploading()))
+		{
+			ImGui::Text("Refining: %d squares", (int)geometry.squares.size());
 		}
 
 		ImGui::End();
 
-		auto run = [&](int f1, int f2, std::string_view filename)
+		// squares arrive outermost first, they replace the old spiral once the bounds are known
+		if (spiral_job.valid())
 		{
-			if (!started)
+			// looked at before the stream, whatever the job published before finishing is taken below
+			auto const finished = spiral_job.ready();
+
+			float min_x, min_y, max_x, max_y;
+			if (spiral_job_stream->job() == spiral_job.id && !streaming && spiral_job_stream->bounds(min_x, min_y, max_x, max_y))
 			{
-				worker_thread = render_fibonacci_spiral(
-					width,
-					height,
-					f1,
-					f2,
-					started,
-					sequence_ready,
-					proceed,
-					filename,
-					save);
+				streaming = true;
+				has_geometry = true;
+				cached_request = request_key{};
+				geometry = fib::spiral_geometry{};
+				geometry.min_x = min_x; geometry.min_y = min_y;
+				geometry.max_x = max_x; geometry.max_y = max_y;
+
+				camera.viewport(0., 0., width, height);
+				camera.fit(geometry.min_x, geometry.min_y, geometry.max_x, geometry.max_y);
+				if (square_renderer.initialized())
+					square_renderer.clear();
+				staged_deep_zoom = false;
+				visible_current = false;
+
+				// an adopted speculation starts from what it published while it was not shown
+				if (spiral_job_stream == &speculative_stream)
+					chunks = std::exchange(speculative_chunks, {});
 			}
-			else if (sequence_ready)
+
+			if (spiral_job_stream->job() == spiral_job.id && streaming)
+				spiral_job_stream->take(chunks);
+
+			if (!chunks.empty())
+			{
+				for (auto const& chunk : chunks)
+				{
+					geometry.squares.insert(geometry.squares.end(), chunk.cbegin(), chunk.cend());
+					if (square_renderer.initialized() && !staged_deep_zoom)
+						square_renderer.append(chunk);
+				}
+				chunks.clear();
+			}
+
+			if (finished)
 			{
-				proceed = true;
+				auto const& outcome = spiral_job.outcome.get();
+				if (outcome.status == fib::job_status::done && outcome.result)
+				{
+					// the squares came through the stream, only the exact index is left
+					geometry.index = std::move(*outcome.result);
+					cached_request = spiral_job_request;
+					visible_current = false;
+				}
+				else
+				{
+					// the file did not load or failed validation, it is not retried until it changes
+					if (outcome.status == fib::job_status::done)
+						rejected_request = spiral_job_request;
+
+					// a partial spiral is not kept
+					if (streaming)
+					{
+						has_geometry = false;
+						geometry = fib::spiral_geometry{};
+						if (square_renderer.initialized())
+							square_renderer.clear();
+					}
+				}
 
-				if (worker_thread.joinable())
-					worker_thread.join();
+				streaming = false;
+				spiral_job = {};
+			}
+		}
+
+		// set by run(), a job nobody asks for any more is cancelled
+		bool requested = false;
 
-				sequence_ready = false;
-				proceed = false;
-				started = false;
+		auto run = [&](unsigned int f1, unsigned int f2, std::string_view filename, std::uint64_t file_version)
+		{
+			auto request = request_key{ f1, f2, std::string(filename), save, file_version };
+			requested = true;
+
+			if (has_geometry && request == cached_request)
+				return;
+			if (request == rejected_request)
+				return;
+			if (spiral_job.valid() && request == spiral_job_request)
+				return;
+
+			// the job in flight is cancelled, its squares are no longer taken
+			if (spiral_job.valid())
+				spiral_job_scheduler->cancel(spiral_job.id);
+			streaming = false;
+
+			// typed ahead, the speculation carries on as the job
+			if (speculation.valid() && request == speculation_request)
+			{
+				spiral_job = std::exchange(speculation, {});
+				spiral_job_request = std::move(request);
+				spiral_job_scheduler = &speculative_jobs;
+				spiral_job_stream = &speculative_stream;
+				++promoted;
+				return;
 			}
+
+			spiral_job = spiral_jobs.submit(request);
+			spiral_job_request = std::move(request);
+			spiral_job_scheduler = &spiral_jobs;
+			spiral_job_stream = &stream;
 		};
 
 		if (load && !pressed)
@@ -244,11 +484,16 @@ int main(int, char**)
 				sub = filename.substr(filename.size() - 4, 4);
 			}
 
+			// no file system access unless the watcher saw the file change
+			load_watcher.watch(filename);
+			load_watcher.update();
+			auto const& metadata = load_watcher.metadata();
+
 			if (!filename.empty() && 
-				sub == ".bin" && 
-				std::ifstream(filename.data()).is_open())
+				(sub == ".bin" || sub == ".txt") && 
+				metadata.exists)
 			{
-				run(0, 0, filename);
+				run(0, 0, filename, metadata.version);
 			}
 			else
 			{
@@ -263,7 +508,121 @@ int main(int, char**)
 			if ((f1 >= 0 && f2 > 0 &&
 				f2 > f1))
 			{
-				run(f1, f2, "");
+				run(f1, f2, "", 0);
+			}
+		}
+
+		// generating was stopped, or the file to load went away
+		if (spiral_job.valid() && !requested)
+			spiral_job_scheduler->cancel(spiral_job.id);
+
+		// the numbers as typed so far, nothing is saved for them
+		auto const first_typed = std::atoi(first_fib_buf);
+		auto const second_typed = std::atoi(second_fib_buf);
+		auto typed_request = request_key{ first_typed, second_typed, "", false, 0 };
+		auto const speculative = speculate && !pressed && !load && !save &&
+			first_typed >= 0 && second_typed > 0 && second_typed > first_typed &&
+			!(has_geometry && typed_request == cached_request);
+
+		if (!speculative && speculation.valid())
+		{
+			speculative_jobs.cancel(speculation.id);
+			speculation = {};
+			speculative_chunks.clear();
+		}
+		else if (speculative && (!speculation.valid() || typed_request != speculation_request))
+		{
+			// replaces the stale speculation, a running one is cancelled
+			speculation = speculative_jobs.submit(typed_request);
+			speculation_request = std::move(typed_request);
+			speculative_chunks.clear();
+		}
+
+		if (speculation.valid() && speculative_stream.job() == speculation.id)
+			speculative_stream.take(speculative_chunks);
+
+		// chunks of jobs nobody takes from would fill up the rings
+		for (auto* unshown : { &stream, &speculative_stream })
+		{
+			if (unshown != spiral_job_stream || !spiral_job.valid())
+				unshown->drop_stale();
+		}
+
+		// mouse wheel zooms around the cursor, dragging pans, double click fits the spiral again
+		if (has_geometry && ImGui::IsWindowHovered())
+		{
+			if (io.MouseWheel != 0.f)
+				camera.zoom_at(io.MousePos.x, io.MousePos.y, std::pow(1.1, io.MouseWheel));
+
+			if (ImGui::IsMouseDoubleClicked(0))
+				camera.fit(geometry.min_x, geometry.min_y, geometry.max_x, geometry.max_y);
+			else if (ImGui::IsMouseClicked(0))
+				panning = true;
+		}
+
+		if (panning && ImGui::IsMouseDown(0))
+			camera.pan(io.MouseDelta.x, io.MouseDelta.y);
+		else
+			panning = false;
+
+		// only the camera changes from frame to frame, the cached geometry is reprojected
+		if (has_geometry && (pressed || load) && deep_zoom && !streaming)
+		{
+			// region relative float coordinates straight from the double precision index, half a view
+			// around the camera so that panning does not look them up every frame
+			auto const min_size = 1. / std::max(camera.scale_x(), camera.scale_y());
+			auto const inside = camera.left() >= visible_region.min_x && camera.right() <= visible_region.max_x &&
+				camera.bottom() >= visible_region.min_y && camera.top() <= visible_region.max_y;
+			if (!visible_current || !inside || min_size != visible_min_size)
+			{
+				auto const margin_x = (camera.right() - camera.left()) / 2., margin_y = (camera.top() - camera.bottom()) / 2.;
+				visible_region = fib::spiral_index::bounds{
+					camera.left() - margin_x, camera.bottom() - margin_y, camera.right() + margin_x, camera.top() + margin_y };
+				visible_min_size = min_size;
+				visible_current = true;
+				visible_staged = false;
+				geometry.index.visible_squares(
+					visible_region.min_x, visible_region.min_y, visible_region.max_x, visible_region.max_y,
+					min_size,
+					visible_region.min_x, visible_region.max_y,
+					IM_COL32(255, 255, 255, 255),
+					visible_squares);
+			}
+
+			auto const relative_camera = camera.relative_to(visible_region.min_x, visible_region.max_y);
+			if (instanced)
+			{
+				// staged again only when they changed, the upload budget spreads a large set over frames
+				auto const [sx, sy, tx, ty] = relative_camera.world_to_screen();
+				if (!visible_staged || !staged_deep_zoom)
+					square_renderer.stage(visible_squares);
+				visible_staged = true;
+				square_renderer.world_to_screen(sx, sy, tx, ty);
+				square_renderer.add_to(ImGui::GetWindowDrawList());
+				staged_deep_zoom = true;
+			}
+			else
+			{
+				draw_squares(ImGui::GetWindowDrawList(), visible_squares, relative_camera, ImVec2((float)width, (float)height), draw_budget_ms);
+			}
+		}
+		else if (has_geometry && (pressed || load))
+		{
+			if (instanced)
+			{
+				if (staged_deep_zoom)
+				{
+					square_renderer.stage(geometry.squares);
+					staged_deep_zoom = false;
+				}
+
+				auto const [sx, sy, tx, ty] = camera.world_to_screen();
+				square_renderer.world_to_screen(sx, sy, tx, ty);
+				square_renderer.add_to(ImGui::GetWindowDrawList());
+			}
+			else
+			{
+				draw_squares(ImGui::GetWindowDrawList(), geometry.squares, camera, ImVec2((float)width, (float)height), draw_budget_ms);
 			}
 		}
 
@@ -282,6 +641,10 @@ int main(int, char**)
     }
 
     // Cleanup
+	// jobs still in flight are cancelled, the schedulers wait for them before the streams and the writers go
+	spiral_jobs.cancel_all();
+	speculative_jobs.cancel_all();
+	square_renderer.shutdown();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
@@ -292,159 +655,264 @@ int main(int, char**)
     return 0;
 }
 
-std::thread render_fibonacci_spiral(
-	int window_width,
-	int window_height,
-	unsigned int first_fibonacci_number,
-	unsigned int second_fibonacci_number,
-	std::atomic<bool>& started,
-	std::atomic<bool>& sequence_ready,
-	std::atomic<bool>& proceed,
-	std::string_view filename, 
-	bool save
-	)
+std::shared_ptr<fib::spiral_index> build_fibonacci_spiral(
+	request_key const& request,
+	fib::job_context const& context,
+	fib::geometry_stream& stream,
+	fib::background_writer& writer,
+	fib::background_writer& cache_writer)
 {
-	started = true;
-	return std::thread{ [&, window_width, window_height, first_fibonacci_number, second_fibonacci_number, save, filename]() 
-	{ 
-		using points_type = std::vector<ImVec2>;
-		points_type points{};
-		typename points_type::const_iterator xmin, xmax, ymin, ymax;
-
-		while (true)
-		{
-			if (!sequence_ready)
-			{
-				std::vector<int> fibonacci;
-
-				if (filename.empty())
-				{
-					fibonacci.resize(std::size_t(second_fibonacci_number) + 1, 0);
-					std::fill(fibonacci.begin() + 1, fibonacci.end(), 1);
-					std::adjacent_difference(fibonacci.begin() + 1, fibonacci.end() - 1, fibonacci.begin() + 2, std::plus<int>{});
-				}
-				else
-				{
-					// If reading the .txt file, it will be less performant
-					//std::ifstream ifs{ "fibonacci.txt"};
-					//std::copy(std::istream_iterator<int>(ifs), std::istream_iterator<int>(), std::back_inserter(fibonacci));
+	auto const first_fibonacci_number = std::get<0>(request);
+	auto const second_fibonacci_number = std::get<1>(request);
+	std::string_view const filename = std::get<2>(request);
+	auto const save = std::get<3>(request);
+	auto const& cancel = context.cancel;
+	// the index stage and the check run on the pool of the job, a speculation keeps to its own
+	auto& pool = *context.pool;
+
+	// the ui only takes squares from the job it waits for
+	stream.reset(context.id);
+
+	// squares per published chunk, small enough that the first one shows up right away
+	static auto const chunk_size = std::size_t(1) << 14;
+	static auto const color = IM_COL32(255, 255, 255, 255);
+
+	using points_type = decltype(fibonacci_points::points);
+	points_type points{};
+	fib::spiral_index index{};
+
+	// the squares went through the stream, the result is the exact index
+	auto hand_over = [&]()
+	{
+		return std::make_shared<fib::spiral_index>(std::move(index));
+	};
 
-					std::ifstream ifs{ filename.data(), std::ios::binary | std::ios::ate };
+	// no result, whatever was streamed is dropped by the ui, also after a cancel
+	auto give_up = [&]()
+	{
+		stream.cancel();
+		return std::shared_ptr<fib::spiral_index>{};
+	};
 
-					if (!ifs.is_open())
-					{
-						started = false;
-						sequence_ready = false;
-						proceed = false;
-						return;
-					}
+	// generated and decoded terms live in the vector, raw files are read straight from the mapping
+	std::vector<int> generated;
+	fib::mapped_sequence mapped;
+	fib::sequence_header header{};
+	int const* fibonacci_begin = nullptr;
+	int const* fibonacci_end = nullptr;
 
-					auto end = ifs.tellg();
-					ifs.seekg(0, std::ios::beg);
-					auto beg = ifs.tellg();
-					auto fsize = end - beg;
-					auto elem_count = fsize / sizeof(int);
-					fibonacci.resize(elem_count);
-					ifs.read((char*)fibonacci.data(), fsize);
-				}
+	if (filename.empty())
+	{
+		generated = fib::make_fibonacci_sequence(second_fibonacci_number);
+		fibonacci_begin = generated.data();
+		fibonacci_end = generated.data() + generated.size();
+	}
+	else
+	{
+		// text is parsed on all cores, raw .bin files are mapped, block coded ones decoded
+		fib::text_read_stats text_stats{};
+		auto const loaded = fib::is_text_file(filename) ?
+			fib::read_text(filename, generated, 0, text_stats, cancel) :
+			fib::read_sequence_header(filename, header) &&
+			(header.encoding == fib::sequence_encoding::raw ? mapped.open(filename) : fib::read_sequence(filename, generated, cancel));
+
+		if (!loaded || cancel.cancelled())
+		{
+			return give_up();
+		}
 
-				if (save)
-				{
-					std::ofstream ofs("fibonacci.bin", std::ios::binary);
-					// ImVec2 is packed, so we can just memory map it on disk
-					ofs.write((char*)fibonacci.data(), fibonacci.size() * sizeof(int));
+		if (mapped.begin() != nullptr)
+		{
+			fibonacci_begin = mapped.begin();
+			fibonacci_end = mapped.end();
+		}
+		else
+		{
+			fibonacci_begin = generated.data();
+			fibonacci_end = generated.data() + generated.size();
+		}
+	}
 
-					// write human readable version
-					std::ofstream ofst("fibonacci.txt");
-					std::copy(fibonacci.cbegin(), fibonacci.cend(), std::ostream_iterator<int>(ofst, " "));
-				}
+	auto const count = static_cast<std::size_t>(fibonacci_end - fibonacci_begin);
 
-				points = get_fibonacci_points(fibonacci.cbegin() + first_fibonacci_number, fibonacci.cend());
+	// saving over the loaded file would reload it after every save
+	std::error_code error{};
+	auto const saves_over_source = !filename.empty() &&
+		(std::filesystem::equivalent(filename, "fibonacci.bin", error) || std::filesystem::equivalent(filename, "fibonacci.txt", error));
 
+	if (save && !saves_over_source)
+	{
+		// the writer thread gets its own copy, encoding and the disk stay off the geometry path
+		writer.submit("fibonacci.bin", [terms = std::vector<int>(fibonacci_begin, fibonacci_end)]()
+		{
+			// block coded container, the seeds are the first two terms it was generated or loaded from
+			auto const ok = terms.size() >= 2 ?
+				fib::write_compact_sequence("fibonacci.bin", terms.data(), terms.size(), 0, terms[0], terms[1]) :
+				fib::write_compact_sequence("fibonacci.bin", terms.data(), terms.size());
+
+			// write human readable version
+			fib::text_stats stats{};
+			return fib::write_text("fibonacci.txt", terms.data(), terms.size(), fib::text_options{}, stats) && ok;
+		});
+	}
+
+	// .bin files carry the checksum of their terms, everything else is hashed here, still far cheaper than the geometry
+	auto const terms_checksum = header.version != 0 ? header.checksum : fib::sequence_checksum(fibonacci_begin, count * sizeof(int));
+	auto const cache_key = fib::geometry_cache_key(terms_checksum, count, first_fibonacci_number, color);
+	auto const cache_filename = fib::geometry_cache_filename(cache_key);
+
+	// the whole sequence is validated, the spiral may start later
+	auto const* const terms = fibonacci_begin;
+	if (count < std::size_t(first_fibonacci_number))
+		fibonacci_begin = fibonacci_end;
+	else
+		fibonacci_begin += first_fibonacci_number;
+
+	fib::mapped_geometry cached{};
+	if (cached.open(cache_filename, cache_key))
+	{
+		// the squares are already in stream order and instance layout, only copied into chunks
+		auto const& cached_header = cached.header();
+		stream.publish_bounds(cached_header.min_x, cached_header.min_y, cached_header.max_x, cached_header.max_y);
+		for (auto first = cached.begin(); first != cached.end();)
+		{
+			auto const last = first + std::min<std::size_t>(chunk_size, cached.end() - first);
+			stream.publish(std::vector<fib::square>(first, last), cancel);
+			first = last;
+		}
 
-				auto xpair = std::minmax_element(points.cbegin(), points.cend(), [](auto const& p1, auto const& p2) { return p1.x < p2.x; });
-				xmin = xpair.first;
-				xmax = xpair.second;
-				auto ypair = std::minmax_element(points.cbegin(), points.cend(), [](auto const& p1, auto const& p2) { return p1.y < p2.y; });
-				ymin = ypair.first;
-				ymax = ypair.second;
-				sequence_ready = true;
-			}
+		index = fib::spiral_index(fib::spiral_index::point_vector(cached.points_begin(), cached.points_end()));
+		return hand_over();
+	}
 
-			bool valid = first_fibonacci_number >= second_fibonacci_number;
-			if (proceed)
+	// loaded terms are checked on the other cores while this one builds the geometry, a break cancels it
+	fib::cancellation_source checked{ cancel };
+	auto const build_cancel = checked.token();
+	std::future<void> validated{};
+	if (!filename.empty())
+	{
+		validated = pool.submit([&]()
+		{
+			fib::validation_stats stats{};
+			auto const at = fib::find_recurrence_break(terms, count, std::max(pool.size(), 1u), stats, cancel, pool);
+			if (at != count && !cancel.cancelled())
 			{
-				int xoffset = -(xmin->x), yoffset = ymax->y;
-
-				auto world_height = std::abs(ymax->y - ymin->y);
-				auto world_width = std::abs(xmax->x - xmin->x);
-
-				auto xscale = (float)window_width / world_width;
-				auto yscale = (float)window_height / world_height;
-
-				auto draw_rect = [&xoffset, &yoffset, &xscale, &yscale](ImVec2 const& prev, ImVec2 const& next)
-				{
-					auto [x1, y1] = std::make_pair(prev.x, prev.y);
-					auto [x2, y2] = std::make_pair(next.x, next.y);
-
-					auto const leftmost = std::min(x1, x2);
-					auto const rightmost = std::max(x1, x2);
-					auto const uppermost = std::max(y1, y2);
-					auto const lowermost = std::min(y1, y2);
-
-					auto world_lower_left = fib::point2d<float>(leftmost, lowermost);
-					auto world_lower_right = fib::point2d<float>(rightmost, lowermost);
-					auto world_upper_left = fib::point2d<float>(leftmost, uppermost);
-					auto world_upper_right = fib::point2d<float>(rightmost, uppermost);
-
-					// change coordinate system for screen coordinates
-					y1 = -y1;
-					y2 = -y2;
-
-					auto x = std::min(x1, x2);
-					auto y = std::min(y1, y2);
-					auto xlength = std::abs(x2 - x1);
-					auto ylength = std::abs(y2 - y1);
-
-					x += xoffset;
-					y += yoffset;
+				fprintf(stderr, "'%s' is not a fibonacci sequence, term %d: %d + %d != %d\n",
+					std::string(filename).c_str(), (int)at, terms[at - 2], terms[at - 1], terms[at]);
+				checked.cancel();
+			}
+		});
+	}
+
+	/*
+	 *  the exact index only needs the terms, it is built on the pool from the
+	 *  chunks the transform stage passes along while this thread goes on with
+	 *  the float points and then the squares
+	 */
+	using term_range = std::pair<int const*, int const*>;
+	fib::spiral_index_builder index_builder{};
+	index_builder.reserve(static_cast<std::size_t>(fibonacci_end - fibonacci_begin));
+	fib::pipeline_stage<term_range> index_stage{ [&](term_range& terms)
+	{
+		if (!build_cancel.cancelled())
+			index_builder.append(terms.first, terms.second);
+	}, 8, pool };
 
-					x *= xscale;
-					y *= yscale;
+	auto transformed = get_fibonacci_points(fibonacci_begin, fibonacci_end, build_cancel, [&](int const* first, int const* last)
+	{
+		index_stage.push(term_range{ first, last });
+	});
+	points = std::move(transformed.points);
 
-					xlength *= xscale;
-					ylength *= yscale;
+	auto const min_x = transformed.min_x, min_y = transformed.min_y;
+	auto const max_x = transformed.max_x, max_y = transformed.max_y;
+	if (!points.empty())
+		stream.publish_bounds(min_x, min_y, max_x, max_y);
 
-					auto lower_left = fib::point2d<float>(x, y + ylength);
-					auto upper_left = fib::point2d<float>(x, y);
-					auto lower_right = fib::point2d<float>(x + xlength, y + ylength);
-					auto upper_right = fib::point2d<float>(x + xlength, y);
+	// outermost squares first, each chunk is reversed so the whole stream is ordered by size
+	for (auto last = points.size(); last > 1 && !build_cancel.cancelled();)
+	{
+		auto const first = last > chunk_size + 1 ? last - chunk_size : 1;
+		auto chunk = fib::get_fibonacci_squares(points.cbegin() + (first - 1), points.cbegin() + last, color);
+		std::reverse(chunk.begin(), chunk.end());
+		stream.publish(std::move(chunk), build_cancel);
+		last = first;
+	}
+
+	// runs the check and the rest of the index here if no other pool thread got to them
+	if (validated.valid())
+		pool.wait(validated);
+	index_stage.finish();
+
+	if (build_cancel.cancelled())
+	{
+		return give_up();
+	}
 
-					ImGui::GetWindowDrawList()->AddRect(
-						ImVec2(upper_left.x(), upper_left.y()),
-						ImVec2(lower_right.x(), lower_right.y()),
-						ImGui::GetColorU32(ImVec4(255, 255, 255, 1.f)));
+	index = index_builder.build();
 
-					return next;
-				};
+	// the squares are rebuilt from the points on the cache writer, the ui has its own
+	cache_writer.submit(cache_filename, [=, points = std::move(points), index_points = index.points()]()
+	{
+		auto squares = fib::get_fibonacci_squares(points.cbegin(), points.cend(), color);
+		std::reverse(squares.begin(), squares.end());
+		return fib::write_geometry_cache(cache_filename, cache_key, min_x, min_y, max_x, max_y,
+			squares.data(), squares.size(), index_points.data(), index_points.size());
+	});
 
-				std::accumulate(points.crbegin() + 1, points.crend(), *points.crbegin(), draw_rect);
+	return hand_over();
+}
 
-				break;
-			}
-		}
+// squares are ordered outermost first, once the budget is spent the remaining ones are too small to matter much
+void draw_squares(ImDrawList* draw_list, std::vector<fib::square> const& squares, fib::camera2d const& camera, ImVec2 const& viewport_size, double budget_ms)
+{
+	using clock = std::chrono::steady_clock;
+	auto const deadline = clock::now() + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double, std::milli>(budget_ms));
+	auto const color = ImGui::GetColorU32(ImVec4(255, 255, 255, 1.f));
 
-		return;
-	}};
+	std::size_t drawn = 0;
+	for (auto const& square : squares)
+	{
+		// reading the clock for every square would cost more than the rectangle
+		if ((++drawn & 63) == 0 && clock::now() > deadline)
+			break;
+
+		auto const upper_left = camera.world_to_screen(square.x, square.y + square.height);
+		auto const lower_right = camera.world_to_screen(square.x + square.width, square.y);
+
+		// off screen
+		if (lower_right.x() < 0.f || lower_right.y() < 0.f ||
+			upper_left.x() > viewport_size.x || upper_left.y() > viewport_size.y)
+			continue;
+
+		// below a pixel the outline collapses into a dot
+		if (lower_right.x() - upper_left.x() < 1.f && lower_right.y() - upper_left.y() < 1.f)
+			continue;
+
+		draw_list->AddRect(
+			ImVec2(upper_left.x(), upper_left.y()),
+			ImVec2(lower_right.x(), lower_right.y()),
+			color);
+	}
 }
 
-template <class FibonacciRandomAccessIt>
-auto get_fibonacci_points(FibonacciRandomAccessIt begin, FibonacciRandomAccessIt end) -> std::vector<ImVec2>
+/*
+ *  the transform and bound stages in one pass. Every 64Ki terms go to
+ *  on_chunk(first, last) before their points are built, so a later stage
+ *  can work on them meanwhile, the pieces overlap by one term. Empty once
+ *  cancelled.
+ */
+template <class FibonacciRandomAccessIt, class OnChunk>
+auto get_fibonacci_points(FibonacciRandomAccessIt begin, FibonacciRandomAccessIt end, fib::cancellation_token const& cancel, OnChunk&& on_chunk) -> fibonacci_points
 {
-	static auto const segments = 10;
-	std::vector<ImVec2> points{};
-	auto const count = std::distance(begin, end) * segments;
-	points.reserve(count);
+	static auto const chunk_terms = std::size_t(1) << 16;
+	fibonacci_points result{};
+	auto& points = result.points;
+	if (std::distance(begin, end) < 2)
+		return result;
+
+	// one point per consecutive pair of terms
+	points.reserve(std::distance(begin, end));
 
 	fib::static_matrix_2f_90d rotation;
 	// start from [0, -1] unit vector
@@ -459,7 +927,10 @@ auto get_fibonacci_points(FibonacciRandomAccessIt begin, FibonacciRandomAccessIt
 
 		auto v = rotation * (scale * v1);
 
-		points.emplace_back(ImVec2{ v1.p2().x(), v1.p2().y() });
+		auto const x = v1.p2().x(), y = v1.p2().y();
+		points.emplace_back(ImVec2{ x, y });
+		result.min_x = std::min(result.min_x, x); result.min_y = std::min(result.min_y, y);
+		result.max_x = std::max(result.max_x, x); result.max_y = std::max(result.max_y, y);
 
 		return v;
 	};
@@ -474,10 +945,22 @@ auto get_fibonacci_points(FibonacciRandomAccessIt begin, FibonacciRandomAccessIt
 
 	fib::point2d<float> p1(0, 0), p2(1, 0);
 	fib::vector2d<float> v(p1, p2);
+	result.min_x = result.max_x = p2.x();
+	result.min_y = result.max_y = p2.y();
 
-	std::vector<std::tuple<float, int>> transformed{ static_cast<unsigned long long>(count) };
+	// one transformation per consecutive pair of terms
+	std::vector<std::tuple<float, int>> transformed{ static_cast<unsigned long long>(std::distance(begin, end) - 1) };
 	std::transform(begin, end - 1, begin + 1, transformed.begin(), transform_op);
-	std::accumulate(transformed.cbegin(), transformed.cend(), v, reduce_op);
+	for (std::size_t i = 0; i < transformed.size(); ++i)
+	{
+		if (i % chunk_terms == 0)
+		{
+			if (cancel.cancelled())
+				return {};
+			on_chunk(begin + i, begin + std::min(i + chunk_terms + 1, transformed.size() + 1));
+		}
+		v = reduce_op(v, transformed[i]);
+	}
 
-	return points;
+	return result;
 };